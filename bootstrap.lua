@@ -34,6 +34,18 @@ if not bot then
             end
         end,
 
+        set_ttl = function(ttl)
+            return 0
+        end,
+
+        get_queue_depth = function(target)
+            return 0
+        end,
+
+        get_queue_stats = function()
+            return { queued = 0, merged = 0, dropped = 0, expired = 0 }
+        end,
+
         get_channels = function()
             return { '#channel' }
         end,
@@ -211,7 +223,11 @@ end
 signal = {
     -- Weak-valued handlers table, so keeping bound handlers will not
     -- prevent an external module from being GC'd
-    __handlers = {}
+    __handlers = {},
+
+    -- Time to live of the messages each handler sends, taken from the
+    -- module that bound it. Weak-keyed for the same reason.
+    __ttls = setmetatable({}, { __mode = 'k' })
 }
 
 function signal.bind_multi(sigtype, handler)
@@ -385,6 +401,10 @@ function signal.bind_raw(sigtype, handler)
         signal.__handlers[sigtype] = setmetatable({ handler }, { __mode = 'v' })
     end
 
+    if modules.__loading then
+        signal.__ttls[handler] = modules.__loading.ttl
+    end
+
     return handler
 end
 
@@ -402,7 +422,11 @@ function signal.dispatch(sigtype, ...)
         sigtype, idumper{...}))
 
     if signal.__handlers[sigtype] then
+        local ttl = bot.set_ttl(0)
+
         for i, handler in ipairs(signal.__handlers[sigtype]) do
+            bot.set_ttl(signal.__ttls[handler] or ttl)
+
             ok, ret = pcall(handler, ...)
 
             if not ok then
@@ -410,6 +434,8 @@ function signal.dispatch(sigtype, ...)
                     handler, ret))
             end
         end
+
+        bot.set_ttl(ttl)
     end
 end
 
@@ -424,7 +450,15 @@ function modules.load(modnam)
     if not package.loaded[modnam] then
         local mod = require(modnam)
 
-        mod.__init()
+        -- Handlers bound from here on belong to this module, and send with
+        -- its time to live (mod.__info.ttl, in milliseconds) if it has one
+        modules.__loading = mod.__info
+        local ok, err = pcall(mod.__init)
+        modules.__loading = nil
+
+        if not ok then
+            error(err, 0)
+        end
 
         local module = {
             exports = setmetatable(mod, {
@@ -2,6 +2,7 @@
 #include "bot/reguser.h"
 #include "bot/handlers.h"
 #include "bot/module.h"
+#include "bot/replay.h"
 
 #include "irc/session.h"
 
@@ -26,8 +27,15 @@
  */
 void sigint(int sig);
 int print_usage(const char *prgname);
-void setup_callbacks(const struct bot *bot);
+void setup_callbacks(struct bot_session *bs);
 void load_admins(struct bot *bot, const char *file);
+int load_networks(struct bot *bot,
+                  const char *file,
+                  const char *nick,
+                  const char *user,
+                  const char *real);
+
+void bot_session_free(void *arg);
 
 static int *_bot_kill = NULL;
 
@@ -41,7 +49,6 @@ void sigint(int sig)
 
 int main(int argc, char **argv)
 {
-    struct irc_session sess;
     struct bot bot;
 
     int autoload = 1;
@@ -55,6 +62,9 @@ int main(int argc, char **argv)
         { "nick",       required_argument, NULL, 'n' },
         { "user",       required_argument, NULL, 'u' },
         { "real",       required_argument, NULL, 'r' },
+        { "networks",   required_argument, NULL, 'N' },
+        { "capture",    required_argument, NULL, 'C' },
+        { "replay",     required_argument, NULL, 'R' },
         { NULL,         no_argument,       NULL,  0  }
     };
 
@@ -63,6 +73,9 @@ int main(int argc, char **argv)
 
     char hostname[HOSTNAME_MAX] = {0};
     char serverpass[SERVERPASS_MAX] = {0};
+    char networks[256] = {0};
+    char capture[256] = {0};
+    char replay[256] = {0};
 
     char nick[IRC_NICK_MAX] = DEFAULT_NICK;
     char user[IRC_USER_MAX] = DEFAULT_USER;
@@ -72,16 +85,9 @@ int main(int argc, char **argv)
 
     memset(&bot, 0, sizeof(bot));
 
-    bot.modules = hashtable_new_with_free(
-            ascii_hash, ascii_equal, free, mod_free);
-
-    bot.regusers = hashtable_new_with_free(ascii_hash, ascii_equal, free, free);
-
-    bot.sess = &sess;
-
     for (;;) {
         int optidx = 0;
-        int opt = getopt_long(argc, argv, "h:P:p:n:u:r:", lopts, &optidx);
+        int opt = getopt_long(argc, argv, "h:P:p:n:u:r:N:C:R:", lopts, &optidx);
 
         if (opt < 0)
             break;
@@ -124,6 +130,21 @@ int main(int argc, char **argv)
                 portno = (uint16_t)atoi(optarg);
                 break;
 
+            case 'N':
+                /* Set networks file */
+                strncpy(networks, optarg, sizeof(networks) - 1);
+                break;
+
+            case 'C':
+                /* Set capture file prefix */
+                strncpy(capture, optarg, sizeof(capture) - 1);
+                break;
+
+            case 'R':
+                /* Set capture file to replay */
+                strncpy(replay, optarg, sizeof(replay) - 1);
+                break;
+
             case '?':
                 /* Handle unknown flag */
                 log_info("%s --help for additional information\n", argv[0]);
@@ -134,18 +155,42 @@ int main(int argc, char **argv)
         }
     }
 
-    if (!strcmp(hostname, "")) {
-        log_fatal("no hostname given, see --help for more information.");
+    if (!strcmp(hostname, "") && !strcmp(networks, "") && !strcmp(replay, "")) {
+        log_fatal("no hostname or networks given, "
+                  "see --help for more information.");
 
         return 1;
     }
 
+    if (reactor_init(&bot.reactor, NULL))
+        return 1;
+
+    bot_timers_init(&bot.timers);
 
-    sess_init(&sess, hostname, portno, nick, user, real, serverpass);
-    log_info("Starting session as '%s' (user '%s', realname '%s')...",
-            sess.nick, sess.user, sess.real);
+    bot.sessions = hashtable_new_with_free(
+            ascii_hash, ascii_equal, free, bot_session_free);
 
-    setup_callbacks(&bot);
+    bot.modules = hashtable_new_with_free(
+            ascii_hash, ascii_equal, free, mod_free);
+
+    bot.regusers = hashtable_new_with_free(ascii_hash, ascii_equal, free, free);
+
+    if (strcmp(capture, ""))
+        bot.capture = capture;
+
+    if (strcmp(replay, "")) {
+        /* Stand-in for whatever server the capture was taken from */
+        bot_add_session(&bot, "replay", "replay", portno,
+                nick, user, real, serverpass);
+    } else {
+        if (strcmp(hostname, ""))
+            bot_add_session(&bot, hostname,
+                    hostname, portno, nick, user, real, serverpass);
+
+        if (strcmp(networks, "")
+                && load_networks(&bot, networks, nick, user, real))
+            return 1;
+    }
 
     log_info("Loading admin list...");
     regusers_load(&bot, "admins.cfg");
@@ -155,20 +200,26 @@ int main(int argc, char **argv)
         mod_load_autoload(&bot, "autoload.cfg");
     }
 
-    log_info("Starting session...");
-
-    _bot_kill = &sess.kill;
+    _bot_kill = &bot.kill;
     signal(SIGINT, sigint);
 
-    sess_main(&sess);
+    if (strcmp(replay, "")) {
+        bot_replay(&bot, "replay", replay);
+    } else {
+        log_info("Starting sessions...");
+        bot_main(&bot);
+    }
 
     log_debug("Saving state and cleaning up...");
     regusers_save(&bot, "admins.cfg");
 
+    /* Disconnect sessions before modules go away */
+    hashtable_free(bot.sessions);
     hashtable_free(bot.modules);
     hashtable_free(bot.regusers);
 
-    sess_destroy(&sess);
+    bot_timers_destroy(&bot);
+    reactor_destroy(&bot.reactor);
 
     log_info("Goodbye!");
     log_destroy();
@@ -186,6 +237,17 @@ int print_usage(const char *prgname)
         "  -n, --nick=<NICK>     set nickname to NICK\n"
         "  -u, --user=<USER>     set username to USER\n"
         "  -r, --real=<REAL>     set realname to REAL\n"
+        "  -N, --networks=<FILE> additionally connect to every network listed "
+                                "in FILE,\n"
+        "                        one 'name:host[:port[:nick[:pass]]]' per "
+                                "line\n"
+        "  -C, --capture=<FILE>  record everything received to "
+                                "FILE.<network>\n"
+        "  -R, --replay=<FILE>   replay a recording as fast as possible "
+                                "instead of\n"
+        "                        connecting and report on the time taken "
+                                "(use the\n"
+        "                        nick the recording was taken with)\n"
         "      --noautoload      supress autoloading of modules listed in "
                                 "autoload.cfg\n"
         "      --help            display this help and exit\n", prgname);
@@ -193,11 +255,58 @@ int print_usage(const char *prgname)
     return 0;
 }
 
-void setup_callbacks(const struct bot *bot)
+int load_networks(struct bot *bot,
+                  const char *file,
+                  const char *nick,
+                  const char *user,
+                  const char *real)
 {
-    struct irc_callbacks *cb = &bot->sess->cb;
+    char linebuf[1024] = {0};
+    FILE *f;
 
-    cb->arg = (void *)bot;
+    if (!(f = fopen(file, "r"))) {
+        log_perror("fopen()", LOG_ERROR);
+        return 1;
+    }
+
+    while (fgets(linebuf, sizeof(linebuf), f)) {
+        char *line = strstrp(linebuf);
+        char *fields[5] = { NULL, NULL, NULL, NULL, NULL };
+        size_t n = 0;
+
+        if (!strlen(line) || (*line == '#'))
+            continue;
+
+        /* name:host[:port[:nick[:pass]]], the password may contain ':' */
+        fields[n++] = line;
+
+        while ((n < 5) && (line = strchr(line, ':'))) {
+            *line++ = '\0';
+            fields[n++] = line;
+        }
+
+        if (n < 2) {
+            log_warn("%s: ignoring malformed network '%s'", file, fields[0]);
+            continue;
+        }
+
+        bot_add_session(bot, fields[0], fields[1],
+                (n > 2) ? (uint16_t)atoi(fields[2]) : 6667,
+                (n > 3) ? fields[3] : nick,
+                user,
+                real,
+                (n > 4) ? fields[4] : "");
+    }
+
+    fclose(f);
+    return 0;
+}
+
+void setup_callbacks(struct bot_session *bs)
+{
+    struct irc_callbacks *cb = &bs->sess.cb;
+
+    cb->arg = bs;
 
     cb->on_event = bot_on_event;
     cb->on_ping = bot_on_ping;
@@ -218,7 +327,183 @@ void setup_callbacks(const struct bot *bot)
     cb->on_idle = bot_on_idle;
 }
 
+
+/*
+ * Sessions
+ */
+static void _bot_session_connect(struct bot_session *bs)
+{
+    if (!sess_attach(&bs->sess, &bs->bot->reactor))
+        return;
+
+    log_warn("%s: connection failed, retrying in %d seconds",
+            bs->name, RECONNECT_DELAY);
+
+    reactor_schedule(&bs->bot->reactor, &bs->reconnect_timer,
+            RECONNECT_DELAY * 1000);
+}
+
+static void _bot_on_reconnect(struct timer *t, void *arg)
+{
+    _bot_session_connect(arg);
+}
+
+int bot_add_session(struct bot *bot,
+                    const char *name,
+                    const char *server,
+                    uint16_t port,
+                    const char *nick,
+                    const char *user,
+                    const char *real,
+                    const char *pass)
+{
+    struct bot_session *bs = NULL;
+
+    if (bot_get_session(bot, name)) {
+        log_warn("Session '%s' already exists", name);
+        return 1;
+    }
+
+    if (!(bs = malloc(sizeof(*bs)))) {
+        log_error("bot_add_session(): not enough memory for allocation");
+        return 1;
+    }
+
+    memset(bs, 0, sizeof(*bs));
+    strncpy(bs->name, name, sizeof(bs->name) - 1);
+    bs->bot = bot;
+
+    sess_init(&bs->sess, server, port, nick, user, real, pass);
+    setup_callbacks(bs);
+
+    if (bot->capture) {
+        char path[512] = {0};
+
+        snprintf(path, sizeof(path), "%s.%s", bot->capture, bs->name);
+
+        if (!capture_create(&bs->capture, path))
+            bs->sess.capture = &bs->capture;
+    }
+
+    timer_init(&bs->reconnect_timer, _bot_on_reconnect, bs);
+
+    log_info("Adding session '%s' as '%s' (user '%s', realname '%s')...",
+            bs->name, bs->sess.nick, bs->sess.user, bs->sess.real);
+
+    hashtable_insert(bot->sessions, strdup(bs->name), bs);
+
+    /* Connect as soon as the event loop is running */
+    reactor_schedule(&bot->reactor, &bs->reconnect_timer, 0);
+
+    return 0;
+}
+
+/* What flood protection did to the session's messages so far */
+static void _bot_log_queue_stats(const struct bot_session *bs)
+{
+    const struct sess_queue_stats *st = &bs->sess.stats;
+
+    log_info("%s: flood protection queued %lu messages, merged %lu, "
+             "dropped %lu, expired %lu",
+             bs->name, st->queued, st->merged, st->dropped, st->expired);
+}
+
+void bot_session_free(void *arg)
+{
+    struct bot_session *bs = arg;
+
+    if (bs->sess.reactor)
+        sess_detach(&bs->sess);
+
+    _bot_log_queue_stats(bs);
+
+    reactor_cancel(&bs->bot->reactor, &bs->reconnect_timer);
+    capture_close(&bs->capture);
+
+    sess_destroy(&bs->sess);
+    free(bs);
+}
+
+struct irc_session *bot_get_session(const struct bot *bot, const char *name)
+{
+    struct bot_session *bs = hashtable_lookup(bot->sessions, name);
+
+    return bs ? &bs->sess : NULL;
+}
+
+int bot_main(struct bot *bot)
+{
+    while (!bot->kill) {
+        struct hashtable_iterator iter;
+        void *k;
+        void *v;
+
+        if (reactor_poll(&bot->reactor, -1) < 0) {
+            log_perror("reactor_poll()", LOG_ERROR);
+            break;
+        }
+
+        /* Reap sessions that lost their connection and schedule reconnects */
+        hashtable_iterator_init(&iter, bot->sessions);
+        while (hashtable_iterator_next(&iter, &k, &v)) {
+            struct bot_session *bs = v;
+
+            if (bs->sess.reactor && !bs->sess.connected) {
+                sess_detach(&bs->sess);
+                _bot_log_queue_stats(bs);
+
+                if (bs->sess.kill)
+                    continue;
+
+                log_info("%s: reconnecting in %d seconds",
+                        bs->name, RECONNECT_DELAY);
+
+                reactor_schedule(&bot->reactor, &bs->reconnect_timer,
+                        RECONNECT_DELAY * 1000);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Messages go to the current session, which only exists while an event or a
+ * timer added during one is handled
+ */
+static int _bot_no_session(const struct bot *bot)
+{
+    if (bot->sess)
+        return 0;
+
+    log_warn("No current session to send to, discarding message");
+    return 1;
+}
+
 int bot_send_message(const struct bot *bot, const struct irc_message *msg)
 {
+    if (_bot_no_session(bot))
+        return -1;
+
     return sess_sendmsg(bot->sess, msg);
 }
+
+int bot_send_message_prio(const struct bot *bot,
+                          const struct irc_message *msg,
+                          enum sess_priority prio)
+{
+    if (_bot_no_session(bot))
+        return -1;
+
+    return sess_sendmsg_prio(bot->sess, msg, prio);
+}
+
+int bot_send_message_ttl(const struct bot *bot,
+                         const struct irc_message *msg,
+                         unsigned ttl)
+{
+    if (_bot_no_session(bot))
+        return -1;
+
+    return sess_sendmsg_ttl(bot->sess, msg, ttl);
+}
@@ -1,7 +1,11 @@
 #ifndef BOT_H
 #define BOT_H
 
+#include "bot/timer.h"
 #include "irc/irc.h"
+#include "irc/capture.h"
+#include "irc/session.h"
+#include "util/reactor.h"
 
 #include <libutil/container/list.h>
 #include <libutil/container/hashtable.h>
@@ -14,14 +18,81 @@
 
 #define TRIGGERS ":,;"
 
+#define BOT_SESSION_NAME_MAX 64
+
+/* Time in seconds to wait before reconnecting a lost session */
+#define RECONNECT_DELAY 10
+
+/*
+ * A single network connection hosted by the bot. The session's callback
+ * argument points back here, so the handlers know where an event came from.
+ */
+struct bot_session
+{
+    char name[BOT_SESSION_NAME_MAX];
+
+    struct bot *bot;
+    struct irc_session sess;
+
+    struct timer reconnect_timer;
+
+    struct capture capture;
+};
+
 struct bot
 {
+    /* Shared event loop driving every session */
+    struct reactor reactor;
+
+    /* Callbacks scheduled by modules */
+    struct bot_timers timers;
+
+    /* Session table, name => struct bot_session */
+    struct hashtable *sessions;
+
+    /*
+     * Session the event currently being handled originates from. Set before
+     * any event is dispatched, so modules can simply respond to it, and reset
+     * once it has been handled. NULL outside of events, e.g. while modules
+     * are autoloaded.
+     */
     struct irc_session *sess;
 
     struct hashtable *modules;
     struct hashtable *regusers;
+
+    /*
+     * If set, sessions added from now on record what they receive to
+     * "<capture>.<session name>", see irc/capture.h
+     */
+    const char *capture;
+
+    /* Time spent in module event handlers, only measured if profile is set */
+    int profile;
+    uint64_t dispatch_ns;
+
+    int kill;
 };
 
+int bot_add_session(struct bot *bot,
+                    const char *name,
+                    const char *server,
+                    uint16_t port,
+                    const char *nick,
+                    const char *user,
+                    const char *real,
+                    const char *pass);
+
+struct irc_session *bot_get_session(const struct bot *bot, const char *name);
+
+int bot_main(struct bot *bot);
+
 int bot_send_message(const struct bot *bot, const struct irc_message *msg);
+int bot_send_message_prio(const struct bot *bot,
+                          const struct irc_message *msg,
+                          enum sess_priority prio);
+int bot_send_message_ttl(const struct bot *bot,
+                         const struct irc_message *msg,
+                         unsigned ttl);
 
 #endif /* defined BOT_H */
@@ -9,6 +9,7 @@
 #include "irc/util.h"
 #include "irc/session.h"
 
+#include "util/clock.h"
 #include "util/log.h"
 #include "util/util.h"
 
@@ -43,16 +44,67 @@ int bot_split_ctcp(const char *source,
     return 0;
 }
 
+/*
+ * Callback arguments are the bot_session an event originates from. It is the
+ * current session while the event is handled, so replies and dispatched events
+ * are directed back to it. Returns the previously current session, to be put
+ * back once done, so bot->sess never outlives the event.
+ */
+static struct irc_session *_bot_enter(struct bot_session *bs)
+{
+    struct irc_session *prev = bs->bot->sess;
+
+    bs->bot->sess = &bs->sess;
+    return prev;
+}
+
+/* Dispatch an event that needs no handling besides the modules' */
+static int _bot_dispatch_from(void *arg, struct mod_event *ev)
+{
+    struct bot_session *bs = arg;
+    struct irc_session *prev = _bot_enter(bs);
+
+    int ret = bot_dispatch_event(bs->bot, ev);
+
+    bs->bot->sess = prev;
+    return ret;
+}
+
 int bot_dispatch_event(struct bot *bot, struct mod_event *ev)
 {
     struct hashtable_iterator iter;
     void *k;
     void *v;
 
+    uint64_t start = 0;
+    unsigned ttl = 0;
+
+    if (!bot->sess) {
+        log_wtf("Event dispatched without a current session");
+        return 1;
+    }
+
+    start = bot->profile ? clock_system_ns() : 0;
+    ttl = bot->sess->send_ttl;
+
+    ev->session = bot->sess;
+
     hashtable_iterator_init(&iter, bot->modules);
-    while (hashtable_iterator_next(&iter, &k, &v))
-        if (((struct mod_loaded *)v)->state->hooks & M(ev->type))
-            ((struct mod_loaded *)v)->handler_func(ev);
+    while (hashtable_iterator_next(&iter, &k, &v)) {
+        struct mod_loaded *mod = v;
+
+        if (mod->state->hooks & M(ev->type)) {
+            /* Whatever the module sends in response expires as it wishes */
+            bot->sess->send_ttl = mod->state->ttl;
+            mod->handler_func(ev);
+        }
+    }
+
+    /* Events may be dispatched from within a timer or another handler */
+    bot->sess->send_ttl = ttl;
+
+    if (bot->profile)
+        bot->dispatch_ns += clock_system_ns() - start;
 
     return 0;
 }
@@ -145,9 +197,9 @@ int bot_handle_command(struct bot *bot,
     });
 }
 
-int bot_on_event(void *arg, const struct irc_message *m)
+int bot_on_event(void *arg, const struct irc_message_view *m)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_RAW,
         .event = {
             .raw = {
@@ -159,7 +211,7 @@ int bot_on_event(void *arg, const struct irc_message *m)
 
 int bot_on_ping(void *arg)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_PING
     });
 }
@@ -169,7 +221,10 @@ int bot_on_privmsg(void *arg,
                    const char *target,
                    const char *msg)
 {
-    struct bot *bot = arg;
+    struct bot_session *bs = arg;
+    struct bot *bot = bs->bot;
+    struct irc_session *prev = _bot_enter(bs);
+    int ret = 0;
 
     if ((msg[0] == 0x01) && (msg[strlen(msg) - 1] == 0x01)) {
         /* CTCP */
@@ -178,7 +233,7 @@ int bot_on_privmsg(void *arg,
 
         bot_split_ctcp(msg, ctcp, sizeof(ctcp), args, sizeof(args));
 
-        return bot_on_ctcp(bot, prefix, target, ctcp, args);
+        ret = bot_on_ctcp(bot, prefix, target, ctcp, args);
     } else {
         /* Message starts with trigger? Fire zeh handler */
         if ((strstr(msg, bot->sess->nick) == msg) &&
@@ -188,7 +243,7 @@ int bot_on_privmsg(void *arg,
             while (isspace(*start))
                 ++start;
 
-            bot_handle_command(bot, prefix, target, start);
+            ret = bot_handle_command(bot, prefix, target, start);
 
 #if 0
             /* Start of the line after strstrp() */
@@ -224,7 +279,7 @@ int bot_on_privmsg(void *arg,
         } else {
             int priv = !irc_is_channel(target);
 
-            return bot_dispatch_event(bot, &(struct mod_event) {
+            ret = bot_dispatch_event(bot, &(struct mod_event) {
                 .type = priv ? EVENT_PRIVATE_MESSAGE : EVENT_PUBLIC_MESSAGE,
                 .event = {
                     .message = {
@@ -237,7 +292,8 @@ int bot_on_privmsg(void *arg,
         }
     }
 
-    return 0;
+    bot->sess = prev;
+    return ret;
 }
 
 int bot_on_notice(void *arg,
@@ -245,7 +301,10 @@ int bot_on_notice(void *arg,
                   const char *target,
                   const char *msg)
 {
-    struct bot *bot = arg;
+    struct bot_session *bs = arg;
+    struct bot *bot = bs->bot;
+    struct irc_session *prev = _bot_enter(bs);
+    int ret = 0;
 
     if ((msg[0] == 0x01) && (msg[strlen(msg) - 1] == 0x01)) {
         /* CTCP response */
@@ -254,11 +313,11 @@ int bot_on_notice(void *arg,
 
         bot_split_ctcp(msg, ctcp, sizeof(ctcp), args, sizeof(args));
 
-        return bot_on_ctcp_response(bot, prefix, target, ctcp, args);
+        ret = bot_on_ctcp_response(bot, prefix, target, ctcp, args);
     } else {
         int priv = !irc_is_channel(target);
 
-        return bot_dispatch_event(bot, &(struct mod_event) {
+        ret = bot_dispatch_event(bot, &(struct mod_event) {
             .type = priv ? EVENT_PRIVATE_NOTICE : EVENT_PUBLIC_NOTICE,
             .event = {
                 .message = {
@@ -269,11 +328,14 @@ int bot_on_notice(void *arg,
             }
         });
     }
+
+    bot->sess = prev;
+    return ret;
 }
 
 int bot_on_join(void *arg, const char *prefix, const char *channel)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_JOIN,
         .event = {
             .join = {
@@ -289,7 +351,7 @@ int bot_on_part(void *arg,
                 const char *channel,
                 const char *reason)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_PART,
         .event = {
             .part = {
@@ -303,7 +365,7 @@ int bot_on_part(void *arg,
 
 int bot_on_quit(void *arg, const char *prefix, const char *reason)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_QUIT,
         .event = {
             .quit = {
@@ -320,7 +382,7 @@ int bot_on_kick(void *arg,
                 const char *channel,
                 const char *reason)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_KICK,
         .event = {
             .kick = {
@@ -335,7 +397,7 @@ int bot_on_kick(void *arg,
 
 int bot_on_nick(void *arg, const char *prefix_old, const char *prefix_new)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_NICK,
         .event = {
             .nick = {
@@ -348,7 +410,7 @@ int bot_on_nick(void *arg, const char *prefix_old, const char *prefix_new)
 
 int bot_on_invite(void *arg, const char *prefix, const char *channel)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_INVITE,
         .event = {
             .invite = {
@@ -365,7 +427,7 @@ int bot_on_topic(void *arg,
                  const char *topic_old,
                  const char *topic_new)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_TOPIC,
         .event = {
             .topic = {
@@ -384,7 +446,7 @@ int bot_on_mode_set(void *arg,
                     char mode,
                     const char *target)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_CHANNEL_MODE_SET,
         .event = {
             .mode_change = {
@@ -403,7 +465,7 @@ int bot_on_mode_unset(void *arg,
                       char mode,
                       const char *target)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_CHANNEL_MODE_UNSET,
         .event = {
             .mode_change = {
@@ -421,7 +483,7 @@ int bot_on_modes(void *arg,
                  const char *channel,
                  const char *modes)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_CHANNEL_MODES,
         .event = {
             .modes = {
@@ -435,7 +497,7 @@ int bot_on_modes(void *arg,
 
 int bot_on_idle(void *arg, time_t lastidle)
 {
-    return bot_dispatch_event(arg, &(struct mod_event){
+    return _bot_dispatch_from(arg, &(struct mod_event){
         .type = EVENT_IDLE,
         .event = {
             .idle = {
@@ -447,14 +509,14 @@ int bot_on_idle(void *arg, time_t lastidle)
 
 int bot_on_connect(void *arg)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_CONNECT
     });
 }
 
 int bot_on_disconnect(void *arg)
 {
-    return bot_dispatch_event(arg, &(struct mod_event) {
+    return _bot_dispatch_from(arg, &(struct mod_event) {
         .type = EVENT_DISCONNECT
     });
 }
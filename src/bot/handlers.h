@@ -20,7 +20,7 @@ int bot_handle_command(struct bot *bot,
                        const char *target,
                        const char *args);
 
-int bot_on_event(void *arg, const struct irc_message *m);
+int bot_on_event(void *arg, const struct irc_message_view *m);
 int bot_on_ping(void *arg);
 
 int bot_on_privmsg(void *arg,
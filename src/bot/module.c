@@ -104,6 +104,10 @@ void mod_free(void *arg)
     int (*exit)();
     struct mod_loaded *mod = (struct mod_loaded *)arg;
 
+    /* Nothing may call into the module once it is gone */
+    if (mod->state)
+        bot_timer_cancel_owner(mod->state->bot, mod->state);
+
     if ((exit = (int (*)())mod_get_symbol(mod, "exit")))
         exit();
 
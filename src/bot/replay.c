@@ -0,0 +1,275 @@
+#include "bot/replay.h"
+#include "bot/bot.h"
+#include "irc/irc.h"
+#include "irc/capture.h"
+#include "irc/session.h"
+#include "util/clock.h"
+#include "util/linebuf.h"
+#include "util/log.h"
+
+#include <sys/resource.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Stages every line goes through, and what is left of sess_handle_message()
+ * once module dispatch is taken out of it
+ */
+#define REPLAY_STAGES         \
+    X(READ,    "read")        \
+    X(TIMERS,  "timers")      \
+    X(PARSE,   "parse")       \
+    X(STATE,   "state")       \
+    X(MODULES, "modules")
+
+#define X(stage, name) REPLAY_##stage,
+enum _replay_stage
+{
+    REPLAY_STAGES
+    REPLAY_STAGE_COUNT
+};
+#undef X
+
+#define X(stage, name) name,
+static const char *_replay_stage_names[] = { REPLAY_STAGES };
+#undef X
+
+/* Source of time while replaying, stays installed afterwards */
+static struct clock_virtual _replay_clock;
+
+
+static size_t _replay_queued(const struct irc_session *sess)
+{
+    size_t n = 0;
+
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i)
+        n += sess->buffer_out[i].count;
+
+    return n;
+}
+
+/* Whether target was already listed along with an earlier priority class */
+static int _replay_listed(const struct irc_session *sess,
+                          int prio,
+                          const char *target)
+{
+    for (int i = 0; i < prio; ++i)
+        if (fairqueue_depth(&sess->buffer_out[i], target))
+            return 1;
+
+    return 0;
+}
+
+static void _replay_print_target(const struct irc_session *sess,
+                                 int prio,
+                                 const char *target)
+{
+    if (!_replay_listed(sess, prio, target))
+        printf("  %-24s %6zu\n", *target ? target : "(no target)",
+               sess_queue_depth(sess, target));
+}
+
+/* Messages left waiting for flood protection, by target */
+static void _replay_print_queue(const struct irc_session *sess)
+{
+    if (!_replay_queued(sess))
+        return;
+
+    printf("Still queued by target:\n");
+
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i) {
+        const struct fairqueue *q = &sess->buffer_out[i];
+        const struct fairqueue_target *t = q->current;
+
+        if (!t)
+            continue;
+
+        do
+            _replay_print_target(sess, i, t->name);
+        while ((t = t->next) != q->current);
+
+        /* Targets with nothing queued but a message merged into another */
+        for (size_t r = 0; r < q->nriders; ++r)
+            if (!hashtable_lookup(q->targets, q->riders[r]))
+                _replay_print_target(sess, i, q->riders[r]);
+    }
+}
+
+static void _replay_print_slab(const struct slab_cache *c)
+{
+    printf("  %-11s %6lu in use %6lu peak %4lu slabs %8zu KiB\n",
+           c->name, c->in_use, c->peak, c->nslabs, slab_cache_bytes(c) / 1024);
+}
+
+int bot_replay(struct bot *bot, const char *name, const char *file)
+{
+    struct bot_session *bs = hashtable_lookup(bot->sessions, name);
+    struct irc_session *sess = NULL;
+    struct irc_message_view msg;
+    struct capture cap;
+    struct rusage ru;
+
+    char line[LINEBUF_MAX];
+    size_t len = 0;
+
+    uint64_t stage_ns[REPLAY_STAGE_COUNT] = {0};
+    uint64_t first = 0;
+    uint64_t prev = 0;
+    uint64_t ts = 0;
+    uint64_t start = 0;
+    uint64_t total = 0;
+
+    unsigned long lines = 0;
+    unsigned long bytes = 0;
+    unsigned long failed = 0;
+    unsigned long replies = 0;
+
+    int res = 0;
+
+    if (!bs) {
+        log_error("No session '%s' to replay into", name);
+        return 1;
+    }
+
+    if (capture_open(&cap, file))
+        return 1;
+
+    sess = &bs->sess;
+
+    /* The capture stands in for the server, never connect */
+    reactor_cancel(&bot->reactor, &bs->reconnect_timer);
+
+    clock_virtual_init(&_replay_clock);
+    clock_set_source(&_replay_clock.source);
+
+    sess->reactor = &bot->reactor;
+    sess->connected = 1;
+    sess->session_start = clock_time();
+    sess->last_sign_of_life = clock_time();
+
+    bot->profile = 1;
+    bot->dispatch_ns = 0;
+
+    /* Measure handling the traffic, not logging every line of it */
+    log_info("Replaying '%s'...", file);
+    log_set_minlevel(LOG_WARNING);
+
+    start = clock_system_ns();
+
+    while (!bot->kill && sess->connected) {
+        uint64_t t0 = clock_system_ns();
+        uint64_t t1;
+        uint64_t t2;
+        uint64_t t3;
+        uint64_t dispatched;
+
+        if ((res = capture_read(&cap, &ts, line, sizeof(line), &len)))
+            break;
+
+        t1 = clock_system_ns();
+        stage_ns[REPLAY_READ] += t1 - t0;
+
+        /* Lines received together share a timestamp, as does their batch */
+        if (lines == 0) {
+            first = prev = ts;
+        } else if (ts > prev) {
+            clock_virtual_advance(&_replay_clock, ts - prev);
+            reactor_poll(&bot->reactor, 0);
+
+            prev = ts;
+        }
+
+        lines++;
+        bytes += len;
+
+        t2 = clock_system_ns();
+        stage_ns[REPLAY_TIMERS] += t2 - t1;
+
+        if (irc_parse_message_view(line, len, &msg)) {
+            failed++;
+            continue;
+        }
+
+        t3 = clock_system_ns();
+        stage_ns[REPLAY_PARSE] += t3 - t2;
+
+        dispatched = bot->dispatch_ns;
+
+        if (sess_handle_message(sess, &msg))
+            log_warn("message handler returned failure");
+
+        /* Module dispatch happens within sess_handle_message() */
+        dispatched = bot->dispatch_ns - dispatched;
+
+        stage_ns[REPLAY_STATE] += clock_system_ns() - t3 - dispatched;
+        stage_ns[REPLAY_MODULES] += dispatched;
+
+        /* Nobody to send anything to */
+        replies += sess->wire.count;
+        outqueue_clear(&sess->wire);
+    }
+
+    total = clock_system_ns() - start;
+
+    log_set_minlevel(LOG_INFO);
+
+    if (res < 0)
+        log_error("Capture file '%s' is damaged after %lu lines", file, lines);
+
+    capture_close(&cap);
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("Replayed %lu lines (%lu bytes, %.1f s of traffic) "
+           "in %.3f s: %.0f lines/s\n",
+           lines, bytes, (double)(prev - first) / 1e9,
+           (double)total / 1e9,
+           total ? (double)lines / ((double)total / 1e9) : 0.0);
+
+    for (int i = 0; i < REPLAY_STAGE_COUNT; ++i)
+        printf("  %-8s %10.3f ms %10.1f ns/line %6.1f%%\n",
+               _replay_stage_names[i],
+               (double)stage_ns[i] / 1e6,
+               lines ? (double)stage_ns[i] / (double)lines : 0.0,
+               total ? 100.0 * (double)stage_ns[i] / (double)total : 0.0);
+
+    printf("Unparseable lines: %lu, replies: %lu sent, %zu still queued\n",
+           failed, replies, _replay_queued(sess));
+
+    printf("Flood protection: %lu queued, %lu merged, %lu dropped, "
+           "%lu expired\n",
+           sess->stats.queued, sess->stats.merged,
+           sess->stats.dropped, sess->stats.expired);
+
+    _replay_print_queue(sess);
+
+    /* Kilobytes on Linux */
+    printf("Peak memory: %ld KiB\n", ru.ru_maxrss);
+
+    const struct slab_cache *slabs[] = {
+        &sess->channel_slab,
+        &sess->user_slab,
+        &sess->member_slab,
+        &sess->mode_slab,
+        &sess->entry_slab
+    };
+
+    printf("Interned strings: %zu (%zu references, %zu bytes)\n",
+           sess->strings.count, sess->strings.refs, sess->strings.bytes);
+
+    printf("Slab caches:\n");
+
+    for (size_t i = 0; i < sizeof(slabs) / sizeof(slabs[0]); ++i)
+        _replay_print_slab(slabs[i]);
+
+    for (int i = 0; i < INTERN_CLASSES; ++i)
+        _replay_print_slab(&sess->strings.classes[i]);
+
+    bot->profile = 0;
+
+    sess->connected = 0;
+    sess_detach(sess);
+
+    return res < 0;
+}
@@ -0,0 +1,18 @@
+#ifndef BOT_REPLAY_H
+#define BOT_REPLAY_H
+
+struct bot;
+
+/*
+ * Feed a capture file (see irc/capture.h) through the session `name', as if it
+ * had been received from the server, and report on how long that took.
+ *
+ * Every line goes through the same steps as it would live, parsing, channel
+ * state and module dispatch, just without a socket and as fast as possible.
+ * Time is virtual and moves as recorded, so flood protection, timeouts and
+ * module timers behave as they did at the time. Replies are counted and
+ * discarded.
+ */
+int bot_replay(struct bot *bot, const char *name, const char *file);
+
+#endif /* defined BOT_REPLAY_H */
@@ -0,0 +1,252 @@
+#include "bot/timer.h"
+#include "bot/bot.h"
+#include "modules/module.h"
+#include "util/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+void bot_timers_init(struct bot_timers *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+static struct bot_timer *_bot_timer_slot(const struct bot_timers *t, size_t i)
+{
+    return &t->chunks[i / BOT_TIMER_CHUNK][i % BOT_TIMER_CHUNK];
+}
+
+/*
+ * Queue a slot up behind all other free ones, so each slot's generation count
+ * advances as slowly as possible
+ */
+static void _bot_timer_put_free(struct bot_timers *t, struct bot_timer *bt)
+{
+    bt->next_free = 0;
+
+    if (t->free_tail)
+        _bot_timer_slot(t, t->free_tail - 1)->next_free = bt->index + 1;
+    else
+        t->free = bt->index + 1;
+
+    t->free_tail = bt->index + 1;
+}
+
+static int _bot_timer_grow(struct bot_timers *t)
+{
+    struct bot_timer **chunks = NULL;
+    struct bot_timer *chunk = NULL;
+    size_t base = t->nchunks * BOT_TIMER_CHUNK;
+    size_t i;
+
+    if (base + BOT_TIMER_CHUNK > BOT_TIMER_MAX) {
+        log_error("Too many timers");
+        return 1;
+    }
+
+    if (!(chunks = realloc(t->chunks, (t->nchunks + 1) * sizeof(*chunks)))
+            || !(chunk = calloc(BOT_TIMER_CHUNK, sizeof(*chunk)))) {
+        log_error("bot_timer_add(): not enough memory for allocation");
+
+        if (chunks)
+            t->chunks = chunks;
+
+        return 1;
+    }
+
+    t->chunks = chunks;
+    t->chunks[t->nchunks++] = chunk;
+
+    /* Lowest slots first */
+    for (i = 0; i < BOT_TIMER_CHUNK; ++i) {
+        chunk[i].index = base + i;
+        _bot_timer_put_free(t, &chunk[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * Active timer by id, NULL if it has fired or has been cancelled since
+ */
+static struct bot_timer *_bot_timer_get(const struct bot *bot, int id)
+{
+    const struct bot_timers *t = &bot->timers;
+    struct bot_timer *bt = NULL;
+
+    size_t i = (size_t)id & (BOT_TIMER_MAX - 1);
+    unsigned gen = (unsigned)id >> BOT_TIMER_INDEX_BITS;
+
+    if ((id <= 0) || (i >= t->nchunks * BOT_TIMER_CHUNK))
+        return NULL;
+
+    bt = _bot_timer_slot(t, i);
+
+    if (!bt->owner || !bt->fn || (bt->gen != gen))
+        return NULL;
+
+    return bt;
+}
+
+static void _bot_timer_release(struct bot *bot, struct bot_timer *bt)
+{
+    struct bot_timers *t = &bot->timers;
+
+    void (*free_arg)(void *) = bt->free_arg;
+    void *arg = bt->arg;
+
+    bt->owner = NULL;
+    bt->fn = NULL;
+    bt->free_arg = NULL;
+
+    /* Outdates every id handed out for this slot so far */
+    bt->gen = (bt->gen % BOT_TIMER_GEN_MAX) + 1;
+
+    _bot_timer_put_free(t, bt);
+    t->count--;
+
+    if (free_arg)
+        free_arg(arg);
+}
+
+static void _bot_timer_cancel(struct bot *bot, struct bot_timer *bt)
+{
+    reactor_cancel(&bot->reactor, &bt->timer);
+
+    if (bt->firing)
+        /* Released as soon as the callback returns */
+        bt->fn = NULL;
+    else
+        _bot_timer_release(bot, bt);
+}
+
+static void _bot_timer_fire(struct timer *t, void *arg)
+{
+    struct bot_timer *bt = arg;
+    struct bot *bot = bt->bot;
+    struct irc_session *sess = bot->sess;
+    unsigned ttl = 0;
+
+    bot->sess = bt->sess;
+
+    if (bot->sess) {
+        ttl = bot->sess->send_ttl;
+        bot->sess->send_ttl = bt->owner->ttl;
+    }
+
+    bt->firing = 1;
+    bt->fn(bot, bt->arg);
+    bt->firing = 0;
+
+    if (bot->sess)
+        bot->sess->send_ttl = ttl;
+
+    bot->sess = sess;
+
+    if (bt->fn && bt->interval && !timer_pending(t))
+        reactor_schedule(&bot->reactor, t, bt->interval);
+
+    if (!bt->fn || !timer_pending(t))
+        _bot_timer_release(bot, bt);
+}
+
+int bot_timer_add(struct bot *bot,
+                  const struct mod *owner,
+                  unsigned long ms,
+                  unsigned long interval_ms,
+                  bot_timer_func fn,
+                  void *arg,
+                  void (*free_arg)(void *arg))
+{
+    struct bot_timers *t = &bot->timers;
+    struct bot_timer *bt = NULL;
+
+    if (!t->free && _bot_timer_grow(t))
+        return -1;
+
+    bt = _bot_timer_slot(t, t->free - 1);
+
+    if (!(t->free = bt->next_free))
+        t->free_tail = 0;
+
+    t->count++;
+
+    if (bt->gen == 0)
+        bt->gen = 1;
+
+    bt->bot = bot;
+    bt->owner = owner;
+    bt->sess = bot->sess;
+    bt->fn = fn;
+    bt->arg = arg;
+    bt->free_arg = free_arg;
+    bt->interval = interval_ms;
+    bt->firing = 0;
+
+    timer_init(&bt->timer, _bot_timer_fire, bt);
+    reactor_schedule(&bot->reactor, &bt->timer, ms);
+
+    return (int)((bt->gen << BOT_TIMER_INDEX_BITS) | bt->index);
+}
+
+int bot_timer_cancel(struct bot *bot, int id)
+{
+    struct bot_timer *bt = _bot_timer_get(bot, id);
+
+    if (!bt)
+        return 1;
+
+    _bot_timer_cancel(bot, bt);
+    return 0;
+}
+
+int bot_timer_reschedule(struct bot *bot, int id, unsigned long ms)
+{
+    struct bot_timer *bt = _bot_timer_get(bot, id);
+
+    if (!bt)
+        return 1;
+
+    reactor_schedule(&bot->reactor, &bt->timer, ms);
+    return 0;
+}
+
+int bot_timer_active(const struct bot *bot, int id)
+{
+    struct bot_timer *bt = _bot_timer_get(bot, id);
+
+    return bt && (timer_pending(&bt->timer) || bt->interval);
+}
+
+void bot_timer_cancel_owner(struct bot *bot, const struct mod *owner)
+{
+    struct bot_timers *t = &bot->timers;
+    size_t i;
+
+    for (i = 0; i < t->nchunks * BOT_TIMER_CHUNK; ++i) {
+        struct bot_timer *bt = _bot_timer_slot(t, i);
+
+        if ((bt->owner == owner) && bt->fn)
+            _bot_timer_cancel(bot, bt);
+    }
+}
+
+void bot_timers_destroy(struct bot *bot)
+{
+    struct bot_timers *t = &bot->timers;
+    size_t i;
+
+    for (i = 0; i < t->nchunks * BOT_TIMER_CHUNK; ++i) {
+        struct bot_timer *bt = _bot_timer_slot(t, i);
+
+        if (bt->owner && bt->fn)
+            _bot_timer_cancel(bot, bt);
+    }
+
+    for (i = 0; i < t->nchunks; ++i)
+        free(t->chunks[i]);
+
+    free(t->chunks);
+    bot_timers_init(t);
+}
@@ -0,0 +1,96 @@
+#ifndef BOT_TIMER_H
+#define BOT_TIMER_H
+
+#include "util/timerwheel.h"
+
+#include <stdlib.h>
+
+/*
+ * Scheduled callbacks for modules, on the timer wheel of the bot's event loop.
+ *
+ * Timers are referred to by id, which stays unique for a long time after the
+ * timer is gone, so a module holding on to the id of a timer that has already
+ * fired can safely cancel it. Every timer belongs to a module and is cancelled
+ * when the module is unloaded.
+ */
+struct bot;
+struct mod;
+struct irc_session;
+
+typedef void (*bot_timer_func)(struct bot *bot, void *arg);
+
+/* Timer slots are allocated in chunks, which never move */
+#define BOT_TIMER_CHUNK 1024
+
+/*
+ * Ids are made up of the slot index and a generation count. Free slots are
+ * reused in the order they were released, so an id only comes back after
+ * BOT_TIMER_GEN_MAX rounds through all free slots.
+ */
+#define BOT_TIMER_INDEX_BITS 20
+#define BOT_TIMER_MAX        (1 << BOT_TIMER_INDEX_BITS)
+#define BOT_TIMER_GEN_MAX    ((1 << (31 - BOT_TIMER_INDEX_BITS)) - 1)
+
+struct bot_timer
+{
+    struct timer timer;
+
+    struct bot *bot;
+    const struct mod *owner;      /* NULL if the slot is free */
+    struct irc_session *sess;     /* session at the time it was scheduled */
+
+    bot_timer_func fn;
+    void *arg;
+    void (*free_arg)(void *arg);
+
+    unsigned long interval;       /* in ms, 0 if it fires only once */
+    unsigned gen;
+    int firing;
+
+    size_t index;
+    size_t next_free;
+};
+
+struct bot_timers
+{
+    struct bot_timer **chunks;
+    size_t nchunks;
+
+    size_t free;      /* first free slot + 1, 0 if none */
+    size_t free_tail; /* last free slot + 1, 0 if none */
+    size_t count; /* slots in use */
+};
+
+void bot_timers_init(struct bot_timers *t);
+void bot_timers_destroy(struct bot *bot);
+
+/*
+ * Call fn(bot, arg) after `ms' milliseconds, then every interval_ms
+ * milliseconds unless that is 0. free_arg, if given, is called on arg once
+ * the timer is gone for good. While fn runs, the bot's current session is the
+ * one that was current when the timer was added, none if that was outside of
+ * an event.
+ *
+ * Returns the timer's id, or -1 if out of memory.
+ */
+int bot_timer_add(struct bot *bot,
+                  const struct mod *owner,
+                  unsigned long ms,
+                  unsigned long interval_ms,
+                  bot_timer_func fn,
+                  void *arg,
+                  void (*free_arg)(void *arg));
+
+/*
+ * Both return nonzero if there is no such timer (any longer). A one-shot
+ * timer can be rescheduled from within its own callback to keep it alive.
+ */
+int bot_timer_cancel(struct bot *bot, int id);
+int bot_timer_reschedule(struct bot *bot, int id, unsigned long ms);
+
+/* Whether the timer is going to fire again */
+int bot_timer_active(const struct bot *bot, int id);
+
+void bot_timer_cancel_owner(struct bot *bot, const struct mod *owner);
+
+#endif /* defined BOT_TIMER_H */
@@ -0,0 +1,161 @@
+#include "irc/capture.h"
+#include "util/log.h"
+
+#include <string.h>
+#include <errno.h>
+
+
+int capture_create(struct capture *c, const char *path)
+{
+    memset(c, 0, sizeof(*c));
+
+    if (!(c->fp = fopen(path, "wb"))) {
+        log_error("Unable to create capture file '%s': %s",
+                path, strerror(errno));
+
+        return 1;
+    }
+
+    if (fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, c->fp) != CAPTURE_MAGIC_LEN) {
+        log_error("Unable to write to capture file '%s': %s",
+                path, strerror(errno));
+
+        capture_close(c);
+        return 1;
+    }
+
+    return 0;
+}
+
+int capture_open(struct capture *c, const char *path)
+{
+    char magic[CAPTURE_MAGIC_LEN];
+
+    memset(c, 0, sizeof(*c));
+
+    if (!(c->fp = fopen(path, "rb"))) {
+        log_error("Unable to open capture file '%s': %s",
+                path, strerror(errno));
+
+        return 1;
+    }
+
+    if ((fread(magic, 1, sizeof(magic), c->fp) != sizeof(magic))
+            || memcmp(magic, CAPTURE_MAGIC, sizeof(magic))) {
+        log_error("'%s' is not a capture file", path);
+
+        capture_close(c);
+        return 1;
+    }
+
+    return 0;
+}
+
+void capture_close(struct capture *c)
+{
+    if (c->fp)
+        fclose(c->fp);
+
+    c->fp = NULL;
+}
+
+void capture_flush(struct capture *c)
+{
+    if (c->fp)
+        fflush(c->fp);
+}
+
+static void _capture_put_varint(FILE *fp, uint64_t v)
+{
+    unsigned char buf[10];
+    size_t n = 0;
+
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+
+        if (v)
+            buf[n] |= 0x80;
+
+        n++;
+    } while (v);
+
+    fwrite(buf, 1, n, fp);
+}
+
+static int _capture_get_varint(FILE *fp, uint64_t *v)
+{
+    int shift = 0;
+    int c;
+
+    *v = 0;
+
+    while ((c = getc(fp)) != EOF) {
+        if (shift > 63)
+            return -1;
+
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+
+        if (!(c & 0x80))
+            return 0;
+    }
+
+    /* EOF right at a record boundary is fine, anywhere else it is not */
+    return (shift == 0) ? 1 : -1;
+}
+
+int capture_write(struct capture *c,
+                  uint64_t ts,
+                  const char *line,
+                  size_t len)
+{
+    /* Timestamps never go backwards, but be safe */
+    _capture_put_varint(c->fp, (ts > c->last) ? ts - c->last : 0);
+    _capture_put_varint(c->fp, len);
+
+    if (fwrite(line, 1, len, c->fp) != len) {
+        log_error("Unable to write to capture file: %s", strerror(errno));
+        return 1;
+    }
+
+    c->last = ts;
+    c->records++;
+
+    return 0;
+}
+
+int capture_read(struct capture *c,
+                 uint64_t *ts,
+                 char *buf,
+                 size_t size,
+                 size_t *len)
+{
+    uint64_t delta;
+    uint64_t n;
+    int res;
+
+    if ((res = _capture_get_varint(c->fp, &delta)))
+        return res;
+
+    if (_capture_get_varint(c->fp, &n))
+        return -1;
+
+    *len = (n < size) ? (size_t)n : size - 1;
+
+    if (fread(buf, 1, *len, c->fp) != *len)
+        return -1;
+
+    /* Skip whatever did not fit */
+    if ((n > *len) && fseek(c->fp, (long)(n - *len), SEEK_CUR))
+        return -1;
+
+    buf[*len] = '\0';
+
+    c->last += delta;
+    c->records++;
+
+    *ts = c->last;
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Recording of received lines, for replaying them later (see bot/replay.h).
+ *
+ * A capture file starts with CAPTURE_MAGIC, followed by one record per line:
+ *
+ *   varint  nanoseconds since the previous record (CLOCK_MONOTONIC)
+ *   varint  length of the line
+ *   bytes   the line, without line terminator
+ *
+ * Varints are LEB128, 7 bits per byte with the least significant group first.
+ * Lines received together share a timestamp, so most records carry only a
+ * single byte of overhead on top of the one or two for the length.
+ */
+#define CAPTURE_MAGIC     "MAKOCAP1"
+#define CAPTURE_MAGIC_LEN 8
+
+struct capture
+{
+    FILE *fp;
+
+    uint64_t last; /* timestamp of the previous record */
+    unsigned long records;
+};
+
+/* Both return nonzero on error */
+int capture_create(struct capture *c, const char *path);
+int capture_open(struct capture *c, const char *path);
+
+void capture_close(struct capture *c);
+
+/* Hand buffered records to the OS, so they survive a crash */
+void capture_flush(struct capture *c);
+
+int capture_write(struct capture *c,
+                  uint64_t ts,
+                  const char *line,
+                  size_t len);
+
+/*
+ * Read the next record into buf, which is NUL terminated. Lines longer than
+ * size - 1 bytes are truncated. Returns 0 on success, 1 at the end of the file
+ * and -1 if the file is damaged.
+ */
+int capture_read(struct capture *c,
+                 uint64_t *ts,
+                 char *buf,
+                 size_t size,
+                 size_t *len);
+
+#endif /* defined CAPTURE_H */
@@ -11,46 +11,127 @@
 #include <assert.h>
 
 
+static void _irc_member_release(struct irc_session *sess,
+                                struct irc_member *member);
+static void _irc_user_free(struct irc_session *sess, struct irc_user *user);
+static struct irc_user *_irc_user_lookup(struct irc_session *sess,
+                                         const char *key);
+static struct irc_member *_irc_member_lookup(const struct irc_channel *chan,
+                                             const char *key);
+
+#define MODE_BIT(i)      (UINT32_C(1) << ((i) % 32))
+#define MODE_ISSET(t, i) ((t)->set[(i) / 32] & MODE_BIT(i))
+#define MODE_SET(t, i)   ((t)->set[(i) / 32] |= MODE_BIT(i))
+#define MODE_CLEAR(t, i) ((t)->set[(i) / 32] &= ~MODE_BIT(i))
+
+
+/* Allocators */
+void irc_channel_state_init(struct irc_session *sess)
+{
+    slab_cache_init(&sess->channel_slab, "channels",
+            sizeof(struct irc_channel));
+    slab_cache_init(&sess->user_slab, "users", sizeof(struct irc_user));
+    slab_cache_init(&sess->member_slab, "members", sizeof(struct irc_member));
+    slab_cache_init(&sess->mode_slab, "modes", sizeof(struct irc_mode));
+    slab_cache_init(&sess->entry_slab, "entries",
+            sizeof(struct irc_mode_entry));
+}
+
+void irc_channel_state_destroy(struct irc_session *sess)
+{
+    slab_cache_destroy(&sess->channel_slab);
+    slab_cache_destroy(&sess->user_slab);
+    slab_cache_destroy(&sess->member_slab);
+    slab_cache_destroy(&sess->mode_slab);
+    slab_cache_destroy(&sess->entry_slab);
+}
+
 /* List management */
-void irc_channel_free(void *data)
+static void _irc_mode_entry_free(struct irc_channel *c,
+                                 struct irc_mode_entry *e)
 {
-    struct irc_channel *channel = (struct irc_channel *)data;
+    intern_release(&c->session->strings, e->mask);
+    intern_release(&c->session->strings, e->setter);
 
-    hashtable_free(channel->users);
-    hashtable_free(channel->modes);
+    slab_free(&c->session->entry_slab, e);
+}
 
-    free(channel);
+static void _irc_mode_release(struct irc_channel *c, struct irc_mode *mode)
+{
+    if (mode->type == IRC_MODE_LIST) {
+        struct irc_mode_entry *e = mode->value.list.first;
+
+        while (e) {
+            struct irc_mode_entry *next = e->next;
+
+            _irc_mode_entry_free(c, e);
+            e = next;
+        }
+
+        hashtable_free(mode->value.list.entries);
+    }
+
+    slab_free(&c->session->mode_slab, mode);
 }
 
-void irc_mode_free(void *data)
+void irc_channel_free(void *data)
 {
-    struct irc_mode *mode = (struct irc_mode *)data;
+    struct irc_channel *channel = (struct irc_channel *)data;
+
+    struct intern_map_iterator iter;
+    struct intern_node *n;
+
+    /* Members and modes come from the session's caches */
+    intern_map_iterator_init(&iter, &channel->users);
+    while ((n = intern_map_iterator_next(&iter)))
+        _irc_member_release(channel->session,
+                intern_map_entry(n, struct irc_member, node));
+
+    for (unsigned i = 0; i < channel->modes.nargs; ++i)
+        _irc_mode_release(channel, channel->modes.args[i]);
 
-    if (mode->type == IRC_MODE_LIST)
-        list_free_all(mode->value.args, list_free_wrapper, NULL);
+    intern_map_destroy(&channel->users);
+    free(channel->modes.args);
 
-    free(mode);
+    intern_release(&channel->session->strings, channel->name);
+    intern_release(&channel->session->strings, channel->key);
+    intern_release(&channel->session->strings, channel->topic_setter);
+
+    slab_free(&channel->session->channel_slab, channel);
 }
 
 /* Channel management */
 int irc_channel_add(struct irc_session *sess, const char *chan)
 {
-    hashtable_insert(sess->channels,
-            strdup(chan), _irc_channel_new(chan, sess));
+    struct irc_channel *c = _irc_channel_new(chan, sess);
+
+    if (!c)
+        return 1;
+
+    hashtable_insert(sess->channels, (char *)c->key, c);
 
     return 0;
 }
 
 int irc_channel_del(struct irc_session *sess, struct irc_channel *chan)
 {
-    hashtable_remove(sess->channels, chan->name);
+    hashtable_remove(sess->channels, chan->key);
 
     return 0;
 }
 
 struct irc_channel *irc_channel_get(struct irc_session *sess, const char *chan)
 {
-    return hashtable_lookup(sess->channels, chan);
+    char buf[IRC_CHANNEL_MAX];
+    const char *key = NULL;
+
+    irc_casefold(sess->casemap, buf, chan, sizeof(buf));
+
+    /* Never interned means no channel has that name */
+    if (!(key = intern_find(&sess->strings, buf)))
+        return NULL;
+
+    return hashtable_lookup(sess->channels, key);
 }
 
 int irc_channel_set_topic(struct irc_channel *chan, const char *topic)
@@ -70,138 +151,463 @@ int irc_channel_set_created(struct irc_channel *chan, time_t created)
 int irc_channel_set_topic_meta(
         struct irc_channel *chan, const char *setter, time_t set)
 {
-    strncpy(chan->topic_setter, setter, sizeof(chan->topic_setter) - 1);
+    if (intern_set(&chan->session->strings, &chan->topic_setter, setter))
+        return 1;
+
     chan->topic_set = set;
 
     return 0;
 }
 
 
+/* Session user management */
+void irc_user_key(struct irc_session *sess, char *dst, const char *nick)
+{
+    size_t i = 0;
+
+    for (; nick[i] && (nick[i] != '!') && (i < IRC_NICK_MAX - 1); ++i)
+        dst[i] = (char)sess->casemap[(unsigned char)nick[i]];
+
+    dst[i] = '\0';
+}
+
+/* Find the interned key for a nick or prefix, if anyone is known by it */
+static const char *_irc_user_find_key(struct irc_session *sess, const char *usr)
+{
+    char buf[IRC_NICK_MAX];
+
+    irc_user_key(sess, buf, usr);
+
+    return intern_find(&sess->strings, buf);
+}
+
+struct irc_user *irc_user_get(struct irc_session *sess, const char *usr)
+{
+    const char *key = NULL;
+
+    assert(sess != NULL);
+    assert(usr != NULL);
+
+    if (!(key = _irc_user_find_key(sess, usr)))
+        return NULL;
+
+    return _irc_user_lookup(sess, key);
+}
+
+int irc_user_set_prefix(
+        struct irc_session *sess, struct irc_user *user, const char *prefix)
+{
+    struct irc_user *other = NULL;
+    struct irc_member *m = NULL;
+
+    const char *key = NULL;
+    char buf[IRC_NICK_MAX];
+
+    assert((strchr(prefix, '!') && strchr(prefix, '@')) && "invalid prefix");
+
+    if ((key = _irc_user_find_key(sess, prefix)) == user->key)
+        /* Same nick, only the case, user or host changed */
+        return intern_set(&sess->strings, &user->prefix, prefix);
+
+    /* The server says the nick is free now, whoever we think has it is gone */
+    if (key && (other = _irc_user_lookup(sess, key))) {
+        log_warn("Dropping stale user '%s' in favour of '%s'",
+                other->prefix, prefix);
+
+        irc_user_del(sess, other);
+    }
+
+    irc_user_key(sess, buf, prefix);
+
+    if (!(key = intern(&sess->strings, buf))
+            || intern_set(&sess->strings, &user->prefix, prefix)) {
+        intern_release(&sess->strings, key);
+        return 1;
+    }
+
+    /*
+     * Every table the user is in is keyed by their nick, move them all. None
+     * of them runs out of buckets by doing so.
+     */
+    for (m = user->memberships; m; m = m->next)
+        intern_map_remove(&m->channel->users, &m->node);
+
+    intern_map_remove(&sess->users, &user->node);
+    intern_release(&sess->strings, user->key);
+
+    user->key = key;
+
+    intern_map_insert(&sess->users, &user->node, user->key);
+
+    for (m = user->memberships; m; m = m->next)
+        intern_map_insert(&m->channel->users, &m->node, user->key);
+
+    return 0;
+}
+
+int irc_user_del(struct irc_session *sess, struct irc_user *user)
+{
+    unsigned n = user->nmemberships;
+
+    assert(sess != NULL);
+
+    if (n == 0) {
+        _irc_user_free(sess, user);
+
+        return 0;
+    }
+
+    /* The last one takes the user with it */
+    while (n--)
+        irc_channel_del_user(user->memberships->channel, user->memberships);
+
+    return 0;
+}
+
+static struct irc_user *_irc_user_lookup(struct irc_session *sess,
+                                         const char *key)
+{
+    struct intern_node *n = intern_map_lookup(&sess->users, key);
+
+    return n ? intern_map_entry(n, struct irc_user, node) : NULL;
+}
+
+static struct irc_member *_irc_member_lookup(const struct irc_channel *chan,
+                                             const char *key)
+{
+    struct intern_node *n = intern_map_lookup(&chan->users, key);
+
+    return n ? intern_map_entry(n, struct irc_member, node) : NULL;
+}
+
+static void _irc_user_free(struct irc_session *sess, struct irc_user *user)
+{
+    intern_map_remove(&sess->users, &user->node);
+
+    intern_release(&sess->strings, user->prefix);
+    intern_release(&sess->strings, user->key);
+
+    slab_free(&sess->user_slab, user);
+}
+
+/*
+ * Unlink a membership from its user, without touching its channel's table, and
+ * release the user along with their last membership
+ */
+static void _irc_member_release(struct irc_session *sess,
+                                struct irc_member *member)
+{
+    struct irc_user *user = member->user;
+
+    *member->pprev = member->next;
+
+    if (member->next)
+        member->next->pprev = member->pprev;
+
+    slab_free(&sess->member_slab, member);
+
+    if (--user->nmemberships == 0)
+        _irc_user_free(sess, user);
+}
+
 /* Channel user management */
 int irc_channel_add_user(struct irc_channel *chan, const char *prefix)
 {
+    struct irc_session *sess = NULL;
+    struct irc_user *user = NULL;
+    struct irc_member *member = NULL;
+
     assert(chan != NULL);
     assert((strchr(prefix, '!') && strchr(prefix, '@')) && "invalid prefix");
 
-    hashtable_insert(chan->users, strdup(prefix), _irc_user_new(prefix, chan));
+    sess = chan->session;
+
+    if ((user = irc_user_get(sess, prefix))) {
+        /* Seen elsewhere already, but this is the freshest user and host */
+        intern_set(&sess->strings, &user->prefix, prefix);
+
+        if (_irc_member_lookup(chan, user->key))
+            return 0;
+    } else {
+        if (!(user = _irc_user_new(prefix, sess)))
+            return 1;
+
+        if (intern_map_insert(&sess->users, &user->node, user->key)) {
+            intern_release(&sess->strings, user->prefix);
+            intern_release(&sess->strings, user->key);
+            slab_free(&sess->user_slab, user);
+
+            return 1;
+        }
+    }
+
+    if (!(member = _irc_member_new(user, chan))
+            || intern_map_insert(&chan->users, &member->node, user->key)) {
+        slab_free(&sess->member_slab, member);
+
+        if (user->nmemberships == 0)
+            irc_user_del(sess, user);
+
+        return 1;
+    }
+
+    member->next = user->memberships;
+    member->pprev = &user->memberships;
+
+    if (member->next)
+        member->next->pprev = &member->next;
+
+    user->memberships = member;
+    user->nmemberships++;
 
     return 0;
 }
 
-int irc_channel_del_user(struct irc_channel *chan, struct irc_user *user)
+int irc_channel_del_user(struct irc_channel *chan, struct irc_member *member)
 {
     assert(chan != NULL);
-    assert(user != NULL);
+    assert(member != NULL);
 
-    hashtable_remove(chan->users, user->prefix);
+    intern_map_remove(&chan->users, &member->node);
+    _irc_member_release(chan->session, member);
 
     return 0;
 }
 
-struct irc_user *irc_channel_get_user(struct irc_channel *chn, const char *usr)
+struct irc_member *irc_channel_get_user(struct irc_channel *chn, const char *usr)
 {
     assert(chn != NULL);
     assert(usr != NULL);
 
-    if (!strchr(usr, '!'))
-        /* No '!', probably means not a full prefix => search by nickname */
-        return irc_channel_get_user_by_nick(chn, usr);
-    else if (strchr(usr, '!') && (strchr(usr, '*') || strchr(usr, '?')))
+    if (strchr(usr, '!') && (strchr(usr, '*') || strchr(usr, '?')))
         /* '!' found, but also '*' and/or '?' => mask, search! */
         return irc_channel_get_user_by_mask(chn, usr);
     else
-        /* Simple lookup */
-        return hashtable_lookup(chn->users, usr);
+        /* Nick or prefix, both are looked up by nick */
+        return irc_channel_get_user_by_nick(chn, usr);
 }
 
-struct irc_user *irc_channel_get_user_by_nick(struct irc_channel *chan,
-                                              const char *nick)
+struct irc_member *irc_channel_get_user_by_nick(struct irc_channel *chan,
+                                                const char *nick)
 {
-    struct hashtable_iterator iter;
-
-    void *prefix;
-    void *user;
+    const char *key = NULL;
 
     assert(chan != NULL);
     assert(nick != NULL);
 
-    hashtable_iterator_init(&iter, chan->users);
-    while (hashtable_iterator_next(&iter, &prefix, &user))
-        if (!irc_user_cmp(prefix, nick))
-            return user;
+    if (!(key = _irc_user_find_key(chan->session, nick)))
+        return NULL;
 
-    return NULL;
+    return _irc_member_lookup(chan, key);
 }
 
-struct irc_user *irc_channel_get_user_by_mask(struct irc_channel *chan,
-                                              const char *mask)
+struct irc_member *irc_channel_get_user_by_mask(struct irc_channel *chan,
+                                                const char *mask)
 {
-    struct hashtable_iterator iter;
-
-    void *prefix;
-    void *user;
+    struct intern_map_iterator iter;
+    struct intern_node *n;
 
     assert(chan != NULL);
     assert(mask != NULL);
 
-    hashtable_iterator_init(&iter, chan->users);
-    while (hashtable_iterator_next(&iter, &prefix, &user))
-        if (!irc_strwcmp(prefix, mask))
-            return user;
+    intern_map_iterator_init(&iter, &chan->users);
+    while ((n = intern_map_iterator_next(&iter))) {
+        struct irc_member *member = intern_map_entry(n, struct irc_member, node);
+
+        if (!irc_strwcmp(member->user->prefix, mask))
+            return member;
+    }
 
     return NULL;
 }
 
-int irc_channel_rename_user(
-        struct irc_channel *chan, struct irc_user *user, const char *pref)
+/*
+ * Modes
+ */
+static int _irc_mode_index(const struct irc_channel *c, char mode)
 {
-    assert((strchr(pref, '!') && strchr(pref, '@')) && "invalid prefix");
+    if ((unsigned char)mode >= IRC_MODE_SLOTS) {
+        log_warn("%s: ignoring non-ASCII mode 0x%02x",
+                c->name, (unsigned char)mode);
+
+        return -1;
+    }
 
-    struct irc_user *newuser = _irc_user_new(pref, chan);
+    return (unsigned char)mode;
+}
 
-    /* Copy modes from old to new */
-    strncpy(newuser->modes, user->modes, sizeof(newuser->modes) - 1);
+static struct irc_mode *_irc_mode_table_get(const struct irc_mode_table *t,
+                                            int i)
+{
+    return t->slot[i] ? t->args[t->slot[i] - 1] : NULL;
+}
 
-    /* Add new user and remove old user */
-    hashtable_insert(chan->users, strdup(pref), newuser);
-    hashtable_remove(chan->users, user->prefix);
+static int _irc_mode_table_put(struct irc_mode_table *t,
+                               int i,
+                               struct irc_mode *m)
+{
+    if (t->nargs == t->argsize) {
+        size_t n = t->argsize ? t->argsize * 2 : 4;
+        struct irc_mode **args = realloc(t->args, n * sizeof(*args));
+
+        if (!args) {
+            log_error("_irc_mode_table_put(): not enough memory for allocation");
+            return 1;
+        }
+
+        t->args = args;
+        t->argsize = (unsigned char)n;
+    }
+
+    t->args[t->nargs++] = m;
+    t->slot[i] = t->nargs;
 
     return 0;
 }
 
-/*
- * Modes
- */
-int irc_channel_set_mode(struct irc_channel *c, char mode, const char *arg)
+static struct irc_mode_entry *_irc_mode_list_find(const struct irc_channel *c,
+                                                  const struct irc_mode_list *l,
+                                                  const char *mask)
+{
+    const char *key = intern_find(&c->session->strings, mask);
+
+    /* Never interned means not on any list */
+    return key ? hashtable_lookup(l->entries, key) : NULL;
+}
+
+static int _irc_mode_list_add(struct irc_channel *c,
+                              struct irc_mode_list *l,
+                              const char *mask,
+                              const char *setter,
+                              time_t set)
+{
+    struct intern_table *strings = &c->session->strings;
+    struct irc_mode_entry *e = NULL;
+
+    if ((e = _irc_mode_list_find(c, l, mask))) {
+        /* Listed already, fill in who and when if we did not know */
+        if (!e->setter && setter && (e->setter = intern(strings, setter)))
+            e->set = set;
+
+        return 0;
+    }
+
+    if (!(e = slab_alloc(&c->session->entry_slab)))
+        return 1;
+
+    if (!(e->mask = intern(strings, mask))) {
+        slab_free(&c->session->entry_slab, e);
+        return 1;
+    }
+
+    /* Only nice to have */
+    e->setter = setter ? intern(strings, setter) : NULL;
+    e->set = set;
+
+    e->prev = l->last;
+
+    if (l->last)
+        l->last->next = e;
+    else
+        l->first = e;
+
+    l->last = e;
+    l->count++;
+
+    hashtable_insert(l->entries, (char *)e->mask, e);
+
+    return 0;
+}
+
+static void _irc_mode_list_del(struct irc_channel *c,
+                               struct irc_mode_list *l,
+                               struct irc_mode_entry *e)
+{
+    hashtable_remove(l->entries, e->mask);
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        l->first = e->next;
+
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        l->last = e->prev;
+
+    l->count--;
+
+    _irc_mode_entry_free(c, e);
+}
+
+static struct irc_mode *_irc_mode_table_drop(struct irc_mode_table *t, int i)
+{
+    unsigned s = t->slot[i] - 1u;
+    struct irc_mode *m = t->args[s];
+
+    /* Move the last one into the hole */
+    t->args[s] = t->args[--t->nargs];
+    t->slot[(unsigned char)t->args[s]->mode] = (unsigned char)(s + 1);
+    t->slot[i] = 0;
+
+    return m;
+}
+
+int irc_channel_set_mode(struct irc_channel *c,
+                         char mode,
+                         const char *arg,
+                         const char *setter,
+                         time_t set)
 {
     assert(c != NULL);
 
     enum irc_mode_type type = _irc_channel_mode_type(c->session, mode);
     if (type != IRC_MODE_CHANUSER) {
-        struct irc_mode *m = hashtable_lookup(c->modes, &mode);
+        struct irc_mode *m = NULL;
+        int i = _irc_mode_index(c, mode);
+
+        if (i < 0)
+            return 1;
 
-        if (m == NULL) {
-            m = _irc_mode_new(mode, type);
-            hashtable_insert(c->modes, chrdup(mode), m);
+        if (type == IRC_MODE_SIMPLE) {
+            MODE_SET(&c->modes, i);
+            return 0;
+        }
+
+        if (!(m = _irc_mode_table_get(&c->modes, i))) {
+            if (!(m = _irc_mode_new(c, mode, type)))
+                return 1;
+
+            if (_irc_mode_table_put(&c->modes, i, m)) {
+                _irc_mode_release(c, m);
+                return 1;
+            }
         }
 
         if (type == IRC_MODE_LIST) {
-            /* Add to list or create list */
-            m->value.args = list_append(m->value.args, strdup(arg));
+            if (_irc_mode_list_add(c, &m->value.list, arg, setter, set)) {
+                if (!m->value.list.count)
+                    _irc_mode_release(c, _irc_mode_table_drop(&c->modes, i));
+
+                return 1;
+            }
         } else if (type == IRC_MODE_SINGLE) {
             /* Replace or place */
             strncpy(m->value.arg, arg, sizeof(m->value.arg) - 1);
         }
+
+        MODE_SET(&c->modes, i);
     } else {
         /* Find channel user and apply mode to them */
-        struct irc_user *usr = irc_channel_get_user(c, arg);
+        struct irc_member *usr = irc_channel_get_user(c, arg);
 
         if (!usr) {
             log_warn("%s: unknown user '%s'", c->name, arg);
             return 1;
         }
 
-        log_debug("%s: set user mode +%c for '%s'", c->name, mode, usr->prefix);
+        log_debug("%s: set user mode +%c for '%s'",
+                c->name, mode, usr->user->prefix);
         irc_channel_user_set_mode(usr, mode);
     }
 
@@ -215,42 +621,47 @@ int irc_channel_unset_mode(struct irc_channel *c, char mode, const char *arg)
     enum irc_mode_type type = _irc_channel_mode_type(c->session, mode);
 
     if (type != IRC_MODE_CHANUSER) {
-        struct irc_mode *m = hashtable_lookup(c->modes, &mode);
+        struct irc_mode *m = NULL;
+        int i = _irc_mode_index(c, mode);
+
+        if (i < 0)
+            return 1;
 
-        if (m == NULL) {
+        if (!MODE_ISSET(&c->modes, i)) {
             /* Mode not set, can not unset */
             log_warn("%s: mode +%c not set, can not unset!", c->name, mode);
             return 1;
         }
 
-        if (type == IRC_MODE_LIST) {
-            /* Try to locate mode in list */
-            struct list *pos = NULL;
-
-            if ((pos = list_find_custom(m->value.args, arg,
-                                        _irc_channel_mode_strcmp, NULL)))
+        m = _irc_mode_table_get(&c->modes, i);
 
-                m->value.args = list_remove_link(m->value.args, pos,
-                                                 list_free_wrapper, NULL);
+        if (m && (m->type == IRC_MODE_LIST)) {
+            struct irc_mode_entry *e = NULL;
 
-            if (!list_length(m->value.args))
-                hashtable_remove(c->modes, &mode);
+            if ((e = _irc_mode_list_find(c, &m->value.list, arg)))
+                _irc_mode_list_del(c, &m->value.list, e);
 
-        } else {
-            /* Remove the whole thing */
-            hashtable_remove(c->modes, &mode);
+            if (m->value.list.count)
+                return 0;
         }
 
+        /* Remove the whole thing */
+        MODE_CLEAR(&c->modes, i);
+
+        if (m)
+            _irc_mode_release(c, _irc_mode_table_drop(&c->modes, i));
+
     } else {
         /* Find channel user and apply mode to them */
-        struct irc_user *usr = irc_channel_get_user(c, arg);
+        struct irc_member *usr = irc_channel_get_user(c, arg);
 
         if (!usr) {
             log_warn("%s: unknown user '%s'", c->name, arg);
             return 1;
         }
 
-        log_debug("%s: set user mode +%c for '%s'", c->name, mode, usr->prefix);
+        log_debug("%s: set user mode +%c for '%s'",
+                c->name, mode, usr->user->prefix);
         irc_channel_user_unset_mode(usr, mode);
     }
 
@@ -258,6 +669,25 @@ int irc_channel_unset_mode(struct irc_channel *c, char mode, const char *arg)
 
 }
 
+int irc_channel_has_mode(const struct irc_channel *c, char mode)
+{
+    assert(c != NULL);
+
+    return ((unsigned char)mode < IRC_MODE_SLOTS)
+        && MODE_ISSET(&c->modes, (unsigned char)mode);
+}
+
+const struct irc_mode *irc_channel_get_mode(const struct irc_channel *c,
+                                            char mode)
+{
+    assert(c != NULL);
+
+    if ((unsigned char)mode >= IRC_MODE_SLOTS)
+        return NULL;
+
+    return _irc_mode_table_get(&c->modes, (unsigned char)mode);
+}
+
 enum irc_mode_type _irc_channel_mode_type(struct irc_session *sess, char mode)
 {
     assert(sess);
@@ -273,86 +703,201 @@ enum irc_mode_type _irc_channel_mode_type(struct irc_session *sess, char mode)
         return IRC_MODE_SIMPLE;
 }
 
-int _irc_channel_mode_strcmp(const void *list, const void *search, void *ud)
+const struct irc_mode_entry *irc_channel_get_list_entry(
+        const struct irc_channel *c, char mode, const char *mask)
 {
-    (void)ud;
+    const struct irc_mode *m = irc_channel_get_mode(c, mode);
+
+    if (!m || (m->type != IRC_MODE_LIST))
+        return NULL;
 
-    return strcmp(list, search);
+    return _irc_mode_list_find(c, &m->value.list, mask);
 }
 
-int irc_channel_user_set_mode(struct irc_user *u, char mode)
+size_t irc_channel_list_count(const struct irc_channel *c, char mode)
 {
+    const struct irc_mode *m = irc_channel_get_mode(c, mode);
+
+    return (m && (m->type == IRC_MODE_LIST)) ? m->value.list.count : 0;
+}
+
+long irc_channel_list_room(const struct irc_channel *c, char mode)
+{
+    const struct irc_session *sess = c->session;
+    const struct irc_maxlist *max = NULL;
+
+    size_t n = 0;
+
+    if (((unsigned char)mode >= IRC_MODE_SLOTS)
+            || !sess->maxlist_group[(unsigned char)mode])
+        return -1;
+
+    max = &sess->maxlist[sess->maxlist_group[(unsigned char)mode] - 1];
+
+    for (const char *m = max->modes; *m; ++m)
+        n += irc_channel_list_count(c, *m);
+
+    return (n < max->limit) ? (long)(max->limit - n) : 0;
+}
+
+/* Rank of a membership mode in PREFIX, -1 if it is none */
+static int _irc_channel_user_rank(const struct irc_member *u, char mode)
+{
+    const struct irc_session *sess = u->channel->session;
+
+    if ((unsigned char)mode >= IRC_MODE_SLOTS)
+        return -1;
+
+    return sess->usermode_rank[(unsigned char)mode] - 1;
+}
+
+int irc_channel_user_set_mode(struct irc_member *u, char mode)
+{
+    int rank;
     assert(u);
 
-    if (!strchr(u->modes, mode) && (strlen(u->modes) < IRC_FLAGS_MAX - 1))
-        u->modes[strlen(u->modes)] = mode;
+    if ((rank = _irc_channel_user_rank(u, mode)) < 0)
+        return 1;
+
+    u->modes |= 1u << rank;
 
     return 0;
 }
 
-int irc_channel_user_unset_mode(struct irc_user *u, char mode)
+int irc_channel_user_unset_mode(struct irc_member *u, char mode)
 {
-    char *pos = NULL;
+    int rank;
     assert(u);
 
-    if ((pos = strchr(u->modes, mode))) {
-        memmove(pos, pos + 1, strlen(u->modes) - (size_t)(pos - u->modes));
+    if (((rank = _irc_channel_user_rank(u, mode)) < 0)
+            || !(u->modes & (1u << rank)))
+        return 1;
 
-        return 0;
-    }
+    u->modes &= ~(1u << rank);
+
+    return 0;
+}
+
+int irc_channel_user_has_mode(const struct irc_member *u, char mode)
+{
+    int rank;
+    assert(u);
 
-    return 1;
+    return ((rank = _irc_channel_user_rank(u, mode)) >= 0)
+        && (u->modes & (1u << rank));
+}
+
+int irc_channel_user_is_at_least(const struct irc_member *u, char mode)
+{
+    int rank;
+    assert(u);
+
+    /* Higher ranks are the lower bits */
+    return ((rank = _irc_channel_user_rank(u, mode)) >= 0)
+        && (u->modes & ((2u << rank) - 1));
+}
+
+void irc_channel_user_modes(const struct irc_member *u, char *dst)
+{
+    const char *usermodes = u->channel->session->usermodes;
+    size_t n = 0;
+
+    for (size_t rank = 0; usermodes[rank] && (n < IRC_FLAGS_MAX - 1); ++rank)
+        if (u->modes & (1u << rank))
+            dst[n++] = usermodes[rank];
+
+    dst[n] = '\0';
 }
 
 /* Utility functions */
-struct irc_user *_irc_user_new(const char *pref, struct irc_channel *c)
+struct irc_user *_irc_user_new(const char *pref, struct irc_session *s)
 {
     assert(pref != NULL);
-    assert(c != NULL);
+    assert(s != NULL);
 
-    struct irc_user *usr = malloc(sizeof(*usr));
+    char key[IRC_NICK_MAX];
+    struct irc_user *usr = slab_alloc(&s->user_slab);
 
-    if (usr) {
-        memset(usr, 0, sizeof(*usr));
-        strncpy(usr->prefix, pref, sizeof(usr->prefix) - 1);
-        usr->channel = c;
-    } else {
+    if (!usr) {
         log_error("_irc_user_new(): not enough memory for allocation");
+        return NULL;
+    }
+
+    irc_user_key(s, key, pref);
+
+    if (!(usr->prefix = intern(&s->strings, pref))
+            || !(usr->key = intern(&s->strings, key))) {
+        intern_release(&s->strings, usr->prefix);
+        slab_free(&s->user_slab, usr);
+
+        return NULL;
     }
 
     return usr;
 }
 
+struct irc_member *_irc_member_new(struct irc_user *u, struct irc_channel *c)
+{
+    assert(u != NULL);
+    assert(c != NULL);
+
+    struct irc_member *mbr = slab_alloc(&c->session->member_slab);
+
+    if (mbr) {
+        mbr->user = u;
+        mbr->channel = c;
+    } else {
+        log_error("_irc_member_new(): not enough memory for allocation");
+    }
+
+    return mbr;
+}
+
 struct irc_channel *_irc_channel_new(const char *name, struct irc_session *s)
 {
     assert(name != NULL);
     assert(s != NULL);
 
-    struct irc_channel *c = malloc(sizeof(*c));
+    char key[IRC_CHANNEL_MAX];
+    struct irc_channel *c = slab_alloc(&s->channel_slab);
 
-    if (c) {
-        memset(c, 0, sizeof(*c));
-        strncpy(c->name, name, sizeof(c->name) - 1);
-
-        c->users = hashtable_new_with_free(ascii_hash, ascii_equal, free, free);
-        c->modes = hashtable_new_with_free(char_hash, char_equal,
-                                           free,      irc_mode_free);
-        c->session = s;
-    } else {
+    if (!c) {
         log_error("_irc_channel_new(): not enough memory for allocation");
+        return NULL;
     }
 
+    irc_casefold(s->casemap, key, name, sizeof(key));
+
+    if (!(c->name = intern(&s->strings, name))
+            || !(c->key = intern(&s->strings, key))) {
+        intern_release(&s->strings, c->name);
+        slab_free(&s->channel_slab, c);
+
+        return NULL;
+    }
+
+    /* Keys and members belong to the session's users */
+    intern_map_init(&c->users);
+    c->session = s;
+
     return c;
 }
 
-struct irc_mode *_irc_mode_new(char mode, enum irc_mode_type type)
+struct irc_mode *_irc_mode_new(struct irc_channel *c,
+                               char mode,
+                               enum irc_mode_type type)
 {
-    struct irc_mode *mde = malloc(sizeof(*mde));
+    assert(c != NULL);
+
+    struct irc_mode *mde = slab_alloc(&c->session->mode_slab);
 
     if (mde) {
-        memset(mde, 0, sizeof(*mde));
         mde->mode = mode;
         mde->type = type;
+
+        if (type == IRC_MODE_LIST)
+            mde->value.list.entries = hashtable_new_with_free(
+                    intern_hash, intern_equal, NULL, NULL);
     } else {
         log_error("_irc_mode_new(): not enough memory for allocation");
     }
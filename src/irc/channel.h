@@ -2,9 +2,11 @@
 #define IRC_CHANNEL_H
 
 #include "irc/irc.h"
+#include "util/intern.h"
 
 #include <libutil/container/hashtable.h>
 
+#include <stdint.h>
 #include <time.h>
 
 enum irc_mode_type
@@ -15,6 +17,36 @@ enum irc_mode_type
     IRC_MODE_CHANUSER /* +o, +v, ... => nick argument   */
 };
 
+#define IRC_MODE_SLOTS   128 /* one per ASCII character */
+#define IRC_MODE_ARG_MAX 64  /* keys, limits and the like are short */
+
+/* One mask on a list mode such as +b, +e or +I */
+struct irc_mode_entry
+{
+    const char *mask;   /* interned, see util/intern.h */
+    const char *setter; /* interned, NULL if unknown */
+    time_t set;
+
+    /* In the order they were set */
+    struct irc_mode_entry *next;
+    struct irc_mode_entry *prev;
+};
+
+/*
+ * List mode entries are hashed by their interned mask, which makes adding,
+ * removing and finding one O(1), and linked in insertion order for walking
+ * them the way the server lists them.
+ */
+struct irc_mode_list
+{
+    struct hashtable *entries; /* mask -> struct irc_mode_entry */
+
+    struct irc_mode_entry *first;
+    struct irc_mode_entry *last;
+    size_t count;
+};
+
+/* A mode that carries arguments */
 struct irc_mode
 {
     char mode;
@@ -23,37 +55,93 @@ struct irc_mode
 
     union irc_mode_argument
     {
-        char arg[IRC_PARAM_MAX];
-        struct list *args;
+        char arg[IRC_MODE_ARG_MAX];
+        struct irc_mode_list list;
     } value;
 };
 
+/*
+ * Channel modes, indexed by their character. Whether a mode is set is a bit,
+ * which is all a simple mode takes up. Modes with arguments also get a slot in
+ * a small array, which slot[] points into by character (off by one, 0 meaning
+ * none).
+ */
+struct irc_mode_table
+{
+    uint32_t set[IRC_MODE_SLOTS / 32];
+    unsigned char slot[IRC_MODE_SLOTS];
+
+    struct irc_mode **args;
+    unsigned char nargs;
+    unsigned char argsize;
+};
+
+/*
+ * Users are known to the session exactly once, in sess->users, no matter how
+ * many channels they share with us. Being in a channel is a membership, which
+ * links user and channel and carries the user's modes in that channel.
+ *
+ * Channels look up memberships by nick, and every user links their own, so
+ * QUIT, NICK and host changes only touch the channels a user is actually in.
+ * Both tables are keyed by the user's folded nick, see irc_user_key(). A user
+ * is released along with their last membership.
+ *
+ * Names, prefixes and keys are interned in sess->strings (see util/intern.h),
+ * so the tables above hash and compare pointers only.
+ */
+struct irc_member;
+
 struct irc_user
 {
+    const char *prefix;
+    const char *key;
+
+    struct intern_node node; /* in sess->users */
+
+    struct irc_member *memberships;
+    unsigned nmemberships;
+};
+
+struct irc_member
+{
+    struct irc_user *user;
     struct irc_channel *channel;
 
-    char prefix[IRC_PREFIX_MAX];
-    char modes[IRC_FLAGS_MAX];
+    struct intern_node node; /* in channel->users */
+
+    /* Bit n is the mode of rank n in PREFIX, see sess->usermodes */
+    unsigned modes;
+
+    /* The user's other memberships */
+    struct irc_member *next;
+    struct irc_member **pprev;
 };
 
 struct irc_channel
 {
     struct irc_session *session;
 
-    char name[IRC_CHANNEL_MAX];
+    const char *name;
+    const char *key; /* folded name, see irc_casefold() */
     time_t created;
 
     char topic[IRC_TOPIC_MAX];
-    char topic_setter[IRC_PREFIX_MAX];
+    const char *topic_setter; /* NULL until known */
     time_t topic_set;
 
-    struct hashtable *users;
-    struct hashtable *modes;
+    struct intern_map users; /* folded nick -> struct irc_member */
+    struct irc_mode_table modes;
 };
 
+/*
+ * Channels, users, memberships and modes come from slab caches in the session
+ * (see util/slab.h), which these set up and release
+ */
+void irc_channel_state_init(struct irc_session *sess);
+void irc_channel_state_destroy(struct irc_session *sess);
+
 /* Hashtable management */
 void irc_channel_free(void *data);
-void irc_mode_free(void *data);
 
 /* Channel management */
 int irc_channel_add(struct irc_session *sess, const char *chan);
@@ -65,38 +153,94 @@ int irc_channel_set_topic(struct irc_channel *chan, const char *topic);
 int irc_channel_set_topic_meta(
         struct irc_channel *chan, const char *setter, time_t set);
 
+/* Session user management */
+
+/*
+ * Fold the nick, or the nick part of a prefix, into the key it is tracked by.
+ * dst has to hold IRC_NICK_MAX bytes.
+ */
+void irc_user_key(struct irc_session *sess, char *dst, const char *nick);
+
+/* Look up a user by nick or prefix */
+struct irc_user *irc_user_get(struct irc_session *sess, const char *usr);
+
+/* Nick and host changes, the user keeps their memberships and modes */
+int irc_user_set_prefix(
+        struct irc_session *sess, struct irc_user *user, const char *prefix);
+
+/* Remove the user from every channel, which releases them */
+int irc_user_del(struct irc_session *sess, struct irc_user *user);
+
 /* Channel user management */
 int irc_channel_add_user(struct irc_channel *chan, const char *prefix);
-int irc_channel_del_user(struct irc_channel *chan, struct irc_user *user);
-struct irc_user *irc_channel_get_user(struct irc_channel *chn, const char *usr);
+int irc_channel_del_user(struct irc_channel *chan, struct irc_member *member);
 
-struct irc_user *irc_channel_get_user_by_nick(struct irc_channel *chan,
-                                              const char *nick);
+/*
+ * Find a member by nick, prefix (only the nick part counts) or, if it contains
+ * wildcards, by mask
+ */
+struct irc_member *irc_channel_get_user(struct irc_channel *chn, const char *usr);
 
-struct irc_user *irc_channel_get_user_by_mask(struct irc_channel *chan,
-                                              const char *mask);
+struct irc_member *irc_channel_get_user_by_nick(struct irc_channel *chan,
+                                                const char *nick);
 
-int irc_channel_rename_user(
-        struct irc_channel *chan, struct irc_user *user, const char *pref);
+struct irc_member *irc_channel_get_user_by_mask(struct irc_channel *chan,
+                                                const char *mask);
 
 /*
  * Modes
  */
 
-/* Channel flags with or without arguments */
-int irc_channel_set_mode(struct irc_channel *c, char mode, const char *arg);
+/*
+ * Channel flags with or without arguments. Who set a list mode entry and when
+ * is kept along with it, setter may be NULL if unknown.
+ */
+int irc_channel_set_mode(struct irc_channel *c,
+                         char mode,
+                         const char *arg,
+                         const char *setter,
+                         time_t set);
+
 int irc_channel_unset_mode(struct irc_channel *c, char mode, const char *arg);
 
+int irc_channel_has_mode(const struct irc_channel *c, char mode);
+
+/* The arguments of a mode that is set, NULL for simple or unset modes */
+const struct irc_mode *irc_channel_get_mode(const struct irc_channel *c,
+                                            char mode);
+
+/* List modes */
+const struct irc_mode_entry *irc_channel_get_list_entry(
+        const struct irc_channel *c, char mode, const char *mask);
+
+size_t irc_channel_list_count(const struct irc_channel *c, char mode);
+
+/*
+ * How many more entries the server takes on a list mode as per ISUPPORT
+ * MAXLIST, counting every list sharing its limit. -1 if there is no limit.
+ */
+long irc_channel_list_room(const struct irc_channel *c, char mode);
+
 enum irc_mode_type _irc_channel_mode_type(struct irc_session *sess, char mode);
-int _irc_channel_mode_strcmp(const void *list, const void *search, void *ud);
 
 /* User flags */
-int irc_channel_user_set_mode(struct irc_user *u, char mode);
-int irc_channel_user_unset_mode(struct irc_user *u, char mode);
+int irc_channel_user_set_mode(struct irc_member *m, char mode);
+int irc_channel_user_unset_mode(struct irc_member *m, char mode);
+
+int irc_channel_user_has_mode(const struct irc_member *m, char mode);
+
+/* Whether the user has the mode or one ranking above it, e.g. +h for ops */
+int irc_channel_user_is_at_least(const struct irc_member *m, char mode);
+
+/* The user's modes as a string, highest rank first. dst holds IRC_FLAGS_MAX. */
+void irc_channel_user_modes(const struct irc_member *m, char *dst);
 
 /* Utility functions */
-struct irc_user *_irc_user_new(const char *pref, struct irc_channel *c);
+struct irc_user *_irc_user_new(const char *pref, struct irc_session *s);
+struct irc_member *_irc_member_new(struct irc_user *u, struct irc_channel *c);
 struct irc_channel *_irc_channel_new(const char *name, struct irc_session *s);
-struct irc_mode *_irc_mode_new(char mode, enum irc_mode_type type);
+struct irc_mode *_irc_mode_new(struct irc_channel *c,
+                               char mode,
+                               enum irc_mode_type type);
 
 #endif /* defined IRC_CHANNEL_H */
@@ -0,0 +1,324 @@
+#include "irc/fairqueue.h"
+#include "util/log.h"
+#include "util/util.h"
+
+#include <libutil/container/hashtable.h>
+
+#include <string.h>
+
+
+static void _fairqueue_target_free(void *data)
+{
+    struct fairqueue_target *t = data;
+
+    outqueue_clear(&t->queue);
+    free(t);
+}
+
+int fairqueue_init(struct fairqueue *fq)
+{
+    memset(fq, 0, sizeof(*fq));
+
+    if (!(fq->targets = hashtable_new_with_free(
+                    ascii_hash,
+                    ascii_equal,
+                    free,
+                    _fairqueue_target_free))) {
+        log_error("fairqueue_init(): not enough memory for allocation");
+        return 1;
+    }
+
+    return 0;
+}
+
+void fairqueue_clear(struct fairqueue *fq)
+{
+    if (fq->targets)
+        hashtable_clear(fq->targets);
+
+    fq->current = NULL;
+    fq->carrier = NULL;
+    fq->nriders = 0;
+    fq->count = 0;
+    fq->bytes = 0;
+}
+
+void fairqueue_destroy(struct fairqueue *fq)
+{
+    if (fq->targets)
+        hashtable_free(fq->targets);
+
+    memset(fq, 0, sizeof(*fq));
+}
+
+/*
+ * Enter a target into the ring right before the current one, so it gets its
+ * turn after every target that was already waiting.
+ */
+static void _fairqueue_link(struct fairqueue *fq, struct fairqueue_target *t)
+{
+    if (!fq->current) {
+        t->prev = t->next = t;
+        fq->current = t;
+    } else {
+        t->next = fq->current;
+        t->prev = fq->current->prev;
+
+        t->prev->next = t;
+        t->next->prev = t;
+    }
+}
+
+/*
+ * Remove a target that ran empty from the ring and release it
+ */
+static void _fairqueue_drop(struct fairqueue *fq, struct fairqueue_target *t)
+{
+    if (t->next == t) {
+        fq->current = NULL;
+    } else {
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+
+        if (fq->current == t)
+            fq->current = t->next;
+    }
+
+    hashtable_remove(fq->targets, t->name);
+}
+
+/*
+ * A message is leaving the queue. If others were merged into it, they are
+ * not waiting any longer either.
+ */
+static void _fairqueue_gone(struct fairqueue *fq, const struct outmsg *m)
+{
+    if (m == fq->carrier) {
+        fq->carrier = NULL;
+        fq->nriders = 0;
+    }
+}
+
+void fairqueue_push(struct fairqueue *fq, const char *target, struct outmsg *m)
+{
+    struct fairqueue_target *t = hashtable_lookup(fq->targets, target);
+
+    if (!t) {
+        if (!(t = calloc(1, sizeof(*t)))) {
+            log_error("fairqueue_push(): not enough memory for allocation");
+
+            free(m);
+            return;
+        }
+
+        strncpy(t->name, target, sizeof(t->name) - 1);
+        outqueue_init(&t->queue);
+
+        hashtable_insert(fq->targets, strdup(t->name), t);
+        _fairqueue_link(fq, t);
+    }
+
+    outqueue_push(&t->queue, m);
+
+    fq->count++;
+    fq->bytes += m->len;
+}
+
+struct outmsg *fairqueue_peek(const struct fairqueue *fq)
+{
+    return fq->current ? outqueue_peek(&fq->current->queue) : NULL;
+}
+
+static struct outmsg *_fairqueue_take(struct fairqueue *fq,
+                                      struct fairqueue_target *t,
+                                      int newest)
+{
+    struct outmsg *m = newest ? outqueue_pop_tail(&t->queue)
+                              : outqueue_pop(&t->queue);
+
+    fq->count--;
+    fq->bytes -= m->len;
+
+    _fairqueue_gone(fq, m);
+
+    if (t->queue.count == 0)
+        _fairqueue_drop(fq, t);
+
+    return m;
+}
+
+struct outmsg *fairqueue_pop(struct fairqueue *fq)
+{
+    struct fairqueue_target *t = fq->current;
+
+    if (!t)
+        return NULL;
+
+    /* Next target's turn, unless this one is dropped anyway */
+    fq->current = t->next;
+
+    return _fairqueue_take(fq, t, 0);
+}
+
+struct outmsg *fairqueue_evict(struct fairqueue *fq, int newest)
+{
+    struct fairqueue_target *t =
+        (struct fairqueue_target *)fairqueue_deepest(fq);
+
+    return t ? _fairqueue_take(fq, t, newest) : NULL;
+}
+
+size_t fairqueue_expire(struct fairqueue *fq, uint64_t now)
+{
+    struct fairqueue_target *t = fq->current;
+    size_t ntargets = 0;
+    size_t expired = 0;
+
+    if (!t)
+        return 0;
+
+    /* Targets running empty leave the ring, so count them beforehand */
+    do
+        ntargets++;
+    while ((t = t->next) != fq->current);
+
+    while (ntargets--) {
+        struct fairqueue_target *next = t->next;
+        struct outmsg *prev = NULL;
+        struct outmsg *m = t->queue.head;
+
+        while (m) {
+            struct outmsg *following = m->next;
+
+            if (m->deadline && (m->deadline <= now)) {
+                outqueue_remove(&t->queue, prev, m);
+
+                fq->count--;
+                fq->bytes -= m->len;
+                expired++;
+
+                _fairqueue_gone(fq, m);
+                free(m);
+            } else {
+                prev = m;
+            }
+
+            m = following;
+        }
+
+        if (t->queue.count == 0)
+            _fairqueue_drop(fq, t);
+
+        t = next;
+    }
+
+    return expired;
+}
+
+/*
+ * Merge m into queued (following prev in t's queue), if fn agrees
+ */
+static int _fairqueue_merge_into(struct fairqueue *fq,
+                                 struct fairqueue_target *t,
+                                 struct outmsg *prev,
+                                 struct outmsg *queued,
+                                 const struct outmsg *m,
+                                 fairqueue_merge_fn fn,
+                                 const void *arg)
+{
+    struct outmsg *merged = fn(queued, m, arg);
+
+    if (!merged)
+        return 1;
+
+    fq->bytes = fq->bytes - queued->len + merged->len;
+
+    outqueue_replace(&t->queue, prev, queued, merged);
+
+    if (queued == fq->carrier)
+        fq->carrier = merged;
+
+    free(queued);
+
+    return 0;
+}
+
+int fairqueue_merge(struct fairqueue *fq,
+                    const char *target,
+                    const struct outmsg *m,
+                    fairqueue_merge_fn fn,
+                    const void *arg)
+{
+    struct fairqueue_target *t = NULL;
+    struct outmsg *prev = NULL;
+
+    /* Targets without queued messages are dropped, so there is a tail */
+    if (!(t = hashtable_lookup(fq->targets, target)))
+        return 1;
+
+    for (struct outmsg *q = t->queue.head; q != t->queue.tail;
+            prev = q, q = q->next)
+        ;
+
+    return _fairqueue_merge_into(fq, t, prev, t->queue.tail, m, fn, arg);
+}
+
+int fairqueue_merge_next(struct fairqueue *fq,
+                         const char *target,
+                         const struct outmsg *m,
+                         fairqueue_merge_fn fn,
+                         const void *arg)
+{
+    struct fairqueue_target *t = fq->current;
+    char *rider = NULL;
+
+    /*
+     * Merged into anything further back, m could be overtaken by later
+     * messages for its target, which get a turn of their own
+     */
+    if (!t || fairqueue_depth(fq, target)
+            || (fq->nriders >= FAIRQUEUE_RIDERS_MAX))
+        return 1;
+
+    if (_fairqueue_merge_into(fq, t, NULL, t->queue.head, m, fn, arg))
+        return 1;
+
+    fq->carrier = t->queue.head;
+
+    rider = fq->riders[fq->nriders++];
+    strncpy(rider, target, FAIRQUEUE_TARGET_MAX - 1);
+    rider[FAIRQUEUE_TARGET_MAX - 1] = '\0';
+
+    return 0;
+}
+
+size_t fairqueue_depth(const struct fairqueue *fq, const char *target)
+{
+    const struct fairqueue_target *t = hashtable_lookup(fq->targets, target);
+    size_t depth = t ? t->queue.count : 0;
+
+    for (size_t i = 0; i < fq->nriders; ++i)
+        if (!strcmp(fq->riders[i], target))
+            depth++;
+
+    return depth;
+}
+
+const struct fairqueue_target *fairqueue_deepest(const struct fairqueue *fq)
+{
+    const struct fairqueue_target *deepest = NULL;
+    const struct fairqueue_target *t = fq->current;
+
+    if (!t)
+        return NULL;
+
+    /* Starting right after the target in turn, so that one loses ties */
+    do {
+        t = t->next;
+
+        if (!deepest || (t->queue.count > deepest->queue.count))
+            deepest = t;
+    } while (t != fq->current);
+
+    return deepest;
+}
@@ -0,0 +1,111 @@
+#ifndef FAIRQUEUE_H
+#define FAIRQUEUE_H
+
+#include "irc/outqueue.h"
+
+#include <stdlib.h>
+
+/*
+ * Queue of outgoing messages that is fair between message targets.
+ *
+ * Every target (the channel or nick a PRIVMSG or NOTICE goes to, "" for
+ * anything else) gets its own FIFO. Target names are compared as they are, so
+ * callers pass them case folded. Targets with queued messages take turns,
+ * one message each, so a target flooding the queue only ever delays its own
+ * messages.
+ */
+#define FAIRQUEUE_TARGET_MAX 128
+
+/* Other targets whose messages can be merged into the one next in turn */
+#define FAIRQUEUE_RIDERS_MAX 8
+
+struct fairqueue_target
+{
+    /* Ring of targets with queued messages, in the order they are served */
+    struct fairqueue_target *prev;
+    struct fairqueue_target *next;
+
+    char name[FAIRQUEUE_TARGET_MAX];
+    struct outqueue queue;
+};
+
+struct fairqueue
+{
+    struct hashtable *targets;
+
+    struct fairqueue_target *current; /* served next, NULL if empty */
+
+    /*
+     * Message next in turn, if messages for other targets have been merged
+     * into it, and those targets. It counts towards their depth until gone.
+     */
+    const struct outmsg *carrier;
+    char riders[FAIRQUEUE_RIDERS_MAX][FAIRQUEUE_TARGET_MAX];
+    size_t nriders;
+
+    size_t count; /* messages queued over all targets */
+    size_t bytes;
+};
+
+int  fairqueue_init(struct fairqueue *fq);
+void fairqueue_clear(struct fairqueue *fq);
+void fairqueue_destroy(struct fairqueue *fq);
+
+void fairqueue_push(struct fairqueue *fq, const char *target, struct outmsg *m);
+
+/*
+ * Next message in turn. Popping it moves on to the next target.
+ */
+struct outmsg *fairqueue_peek(const struct fairqueue *fq);
+struct outmsg *fairqueue_pop(struct fairqueue *fq);
+
+/*
+ * Remove a message from the target with the most messages queued, to make
+ * room for another. Either that target's oldest or newest message.
+ */
+struct outmsg *fairqueue_evict(struct fairqueue *fq, int newest);
+
+/*
+ * Release every queued message whose deadline has passed by now, wherever it
+ * is in its target's queue. Returns the number of messages released.
+ */
+size_t fairqueue_expire(struct fairqueue *fq, uint64_t now);
+
+/*
+ * Offer m, a message for target, to be merged into a queued message. fn is
+ * called with the queued message and returns a record to replace it with, or
+ * NULL. Both return 0 if m has been merged, m itself is never consumed.
+ *
+ * fairqueue_merge() considers the message queued last for target.
+ *
+ * fairqueue_merge_next() considers the message next in turn, as long as
+ * nothing is queued for target. Nothing can overtake that message, so target
+ * sees its messages in order, and it counts towards target's depth until it
+ * is gone. Eviction takes it only as a last resort.
+ */
+typedef struct outmsg *(*fairqueue_merge_fn)(const struct outmsg *queued,
+                                             const struct outmsg *m,
+                                             const void *arg);
+
+int fairqueue_merge(struct fairqueue *fq,
+                    const char *target,
+                    const struct outmsg *m,
+                    fairqueue_merge_fn fn,
+                    const void *arg);
+
+int fairqueue_merge_next(struct fairqueue *fq,
+                         const char *target,
+                         const struct outmsg *m,
+                         fairqueue_merge_fn fn,
+                         const void *arg);
+
+/* Number of messages queued for a target, including merged ones */
+size_t fairqueue_depth(const struct fairqueue *fq, const char *target);
+
+/*
+ * Target with the most messages queued, NULL if empty. On a tie, the one in
+ * turn comes last.
+ */
+const struct fairqueue_target *fairqueue_deepest(const struct fairqueue *fq);
+
+#endif /* defined FAIRQUEUE_H */
@@ -16,67 +16,156 @@
  */
 int irc_parse_message(const char *line, struct irc_message *msg)
 {
-    const char *prev = line;
-    const char *next = line;
-    size_t len;
+    struct irc_message_view view;
+    char copy[IRC_MESSAGE_MAX] = {0};
 
-    memset(msg, 0, sizeof(*msg));
+    strncpy(copy, line, sizeof(copy) - 1);
 
-    /* Check for prefix */
-    if (*prev == ':') {
-        ++prev; /* skip the ':' */
+    if (irc_parse_message_view(copy, strlen(copy), &view))
+        return 1;
 
-        /* Prefix must not be the last part in a message */
-        if (!(next = strchr(prev, ' ')))
-            return 1;
+    irc_message_from_view(msg, &view);
+    return 0;
+}
 
-        /* Calculate token lenght and skip the space */
-        len = (size_t)(next - prev);
-        while (*next == ' ')
-            ++next;
+/*
+ * Terminate the token [start, end) within line and store its position
+ */
+static char *_irc_token_take(struct irc_token *tok,
+                             const char *line,
+                             char *start,
+                             char *end)
+{
+    tok->off = (uint16_t)(start - line);
+    tok->len = (uint16_t)(end - start);
 
-        strncpy(msg->prefix, prev, MIN(len, sizeof(msg->prefix) - 1));
-        prev = next;
+    /* Terminate and skip the separating space(s) */
+    if (*end) {
+        *end++ = '\0';
+
+        while (*end == ' ')
+            ++end;
     }
 
-    /* Command also must not be the last argument in a message */
-    if (!(next = strchr(next, ' ')))
-        return 1;
+    return end;
+}
+
+/*
+ * Undo the termination of tokens, so a line that could not be parsed can still
+ * be logged as received
+ */
+static int _irc_parse_fail(char *line, size_t len)
+{
+    char *nul = line;
 
-    len = (size_t)(next - prev);
-    while (*next == ' ')
-        ++next;
+    while ((nul = memchr(nul, '\0', len - (size_t)(nul - line))))
+        *nul = ' ';
 
-    char cmdbuf[16] = {0};
-    strncpy(cmdbuf, prev, MIN(len, sizeof(cmdbuf) - 1));
+    return 1;
+}
+
+int irc_parse_message_view(char *line,
+                           size_t len,
+                           struct irc_message_view *msg)
+{
+    char *ptr = line;
+    char *end = line + len;
 
-    if ((msg->command = irc_string_to_command(cmdbuf)) == (enum irc_command)-1)
+    if (len > UINT16_MAX)
         return 1;
 
-    do {
-        prev = next;
-        next = strchr(next, ' ') ? strchr(next, ' ') : next + strlen(next);
-        len = (size_t)(next - prev);
+    msg->line = line;
+    msg->paramcount = 0;
 
-        while (*next == ' ')
-            ++next;
+    /* Missing tokens point at the terminator of the line */
+    msg->prefix.off = msg->msg.off = (uint16_t)len;
+    msg->prefix.len = msg->msg.len = 0;
 
-        if (*prev != ':') {
-            strncpy(msg->params[msg->paramcount++], prev,
-                    MIN(len, sizeof(msg->params[0]) - 1));
-        } else {
-            ++prev;
-            len = strlen(prev);
+    /* Check for prefix */
+    if (*ptr == ':') {
+        char *space = NULL;
 
-            strncpy(msg->msg, prev, MIN(len, sizeof(msg->msg) - 1));
+        /* Prefix must not be the last part in a message */
+        if (!(space = memchr(ptr, ' ', (size_t)(end - ptr))))
+            return _irc_parse_fail(line, len);
 
+        ptr = _irc_token_take(&msg->prefix, line, ptr + 1, space);
+    }
+
+    if (ptr == end)
+        return _irc_parse_fail(line, len);
+
+    {
+        char *space = memchr(ptr, ' ', (size_t)(end - ptr));
+        char *cmd = ptr;
+
+        ptr = _irc_token_take(&msg->cmd, line, cmd, space ? space : end);
+
+        /* Unknown commands are parsed as CMD_UNKNOWN, see msg->cmd */
+        msg->command = irc_string_to_command(cmd);
+    }
+
+    while (ptr < end) {
+        char *space = NULL;
+
+        if (*ptr == ':') {
+            _irc_token_take(&msg->msg, line, ptr + 1, end);
             break;
         }
-    } while (next < line + strlen(line));
+
+        space = memchr(ptr, ' ', (size_t)(end - ptr));
+
+        if (msg->paramcount < IRC_PARAM_COUNT_MAX)
+            ptr = _irc_token_take(&msg->params[msg->paramcount++],
+                    line, ptr, space ? space : end);
+        else
+            /* Silently drop parameters beyond the maximum */
+            ptr = space ? space + 1 : end;
+    }
 
     return 0;
 }
 
+const char *irc_view_prefix(const struct irc_message_view *msg)
+{
+    return msg->line + msg->prefix.off;
+}
+
+const char *irc_view_command(const struct irc_message_view *msg)
+{
+    return msg->line + msg->cmd.off;
+}
+
+const char *irc_view_param(const struct irc_message_view *msg, int i)
+{
+    if ((i < 0) || (i >= msg->paramcount))
+        return "";
+
+    return msg->line + msg->params[i].off;
+}
+
+const char *irc_view_msg(const struct irc_message_view *msg)
+{
+    return msg->line + msg->msg.off;
+}
+
+void irc_message_from_view(struct irc_message *dest,
+                           const struct irc_message_view *src)
+{
+    memset(dest, 0, sizeof(*dest));
+
+    strncpy(dest->prefix, irc_view_prefix(src), sizeof(dest->prefix) - 1);
+    dest->command = src->command;
+
+    for (int i = 0; i < src->paramcount; ++i)
+        strncpy(dest->params[i], irc_view_param(src, i),
+                sizeof(dest->params[i]) - 1);
+
+    dest->paramcount = src->paramcount;
+
+    strncpy(dest->msg, irc_view_msg(src), sizeof(dest->msg) - 1);
+}
+
 void irc_print_message(const struct irc_message *i)
 {
     if (strlen(i->prefix))
@@ -107,7 +196,8 @@ unsigned irc_message_to_string(const struct irc_message *i,
     if (strlen(i->msg) > 0)
         pos += snprintf(dest + pos, MAX((int)n - pos, 0), " :%s", i->msg);
 
-    return strlen(dest);
+    /* snprintf() reports the untruncated length */
+    return (unsigned)MIN((size_t)pos, n - 1);
 }
 
 unsigned irc_message_size(const struct irc_message *i)
@@ -149,25 +239,93 @@ const char *irc_command_to_string(enum irc_command cmd)
 #define X(cmd) case CMD_ ## cmd: return #cmd;
         IRC_COMMANDS;
 #undef X
+        case CMD_UNKNOWN: return "UNKNOWN";
         default: return NULL;
     }
 }
 
-enum irc_command irc_string_to_command(const char *cmd)
+/*
+ * Command lookup tables, both generated from protocol.h.
+ *
+ * Numerics are their own enum values, so a table of known numerics indexed by
+ * the numeric itself is all it takes. Textual commands are looked up in an
+ * open addressed hash table with linear probing. The hash function happens to
+ * be collision free for IRC_COMMANDS, so a lookup usually costs one hash and
+ * at most one strcmp(), but new commands can never shadow each other.
+ */
+#define IRC_COMMAND_HASH_SIZE 64
+
+enum
 {
-    if ((strlen(cmd) == 3) && (isdigit(*(cmd))
-                            && isdigit(*(cmd + 1))
-                            && isdigit(*(cmd + 2)))) {
-#define X(numeric, num) \
-        if (atoi(cmd) == num) return numeric; else
+    IRC_COMMAND_COUNT = 0
+#define X(cmd) + 1
+    IRC_COMMANDS
+#undef X
+};
+
+/* Probing needs a free slot to stop at, fails to compile otherwise */
+typedef char _irc_command_hash_has_room[
+    (IRC_COMMAND_COUNT < IRC_COMMAND_HASH_SIZE) ? 1 : -1];
+
+static const unsigned char _irc_numeric_known[1000] = {
+#define X(name, num) [num] = 1,
     IRC_NUMERICS
 #undef X
-        return -1;
-    } else {
-#define X(ecmd) \
-        if (!strcmp(cmd, #ecmd)) return CMD_ ## ecmd; else
+};
+
+static const char *_irc_command_names[IRC_COMMAND_HASH_SIZE];
+static enum irc_command _irc_command_codes[IRC_COMMAND_HASH_SIZE];
+
+static unsigned _irc_command_hash(const char *cmd, size_t len)
+{
+    /* Every known command is at least 3 characters long */
+    return (unsigned)(len * 9
+                    + ((unsigned char)cmd[0] + (unsigned char)cmd[1]) * 6
+                    + (unsigned char)cmd[len - 1]) % IRC_COMMAND_HASH_SIZE;
+}
+
+static void _irc_command_hash_init(void)
+{
+    unsigned h;
+
+#define X(ecmd)                                                              \
+    h = _irc_command_hash(#ecmd, sizeof(#ecmd) - 1);                         \
+                                                                             \
+    while (_irc_command_names[h])                                            \
+        h = (h + 1) % IRC_COMMAND_HASH_SIZE;                                 \
+                                                                             \
+    _irc_command_names[h] = #ecmd;                                           \
+    _irc_command_codes[h] = CMD_ ## ecmd;
+
     IRC_COMMANDS
 #undef X
-        return -1;
+}
+
+enum irc_command irc_string_to_command(const char *cmd)
+{
+    static int hash_ready = 0;
+    size_t len = strlen(cmd);
+
+    if ((len == 3) && (isdigit(*(cmd))
+                    && isdigit(*(cmd + 1))
+                    && isdigit(*(cmd + 2)))) {
+        int num = (cmd[0] - '0') * 100 + (cmd[1] - '0') * 10 + (cmd[2] - '0');
+
+        return _irc_numeric_known[num] ? (enum irc_command)num : CMD_UNKNOWN;
+    } else if (len >= 3) {
+        unsigned h;
+
+        if (!hash_ready) {
+            _irc_command_hash_init();
+            hash_ready = 1;
+        }
+
+        for (h = _irc_command_hash(cmd, len);
+                _irc_command_names[h];
+                h = (h + 1) % IRC_COMMAND_HASH_SIZE)
+            if (!strcmp(cmd, _irc_command_names[h]))
+                return _irc_command_codes[h];
     }
+
+    return CMD_UNKNOWN;
 }
@@ -29,6 +29,9 @@
 #include "irc/channel.h"
 #include "irc/protocol.h"
 
+#include <stdlib.h>
+#include <stdint.h>
+
 /*
  * Used to classify IRC modes to correctly parse arguments.
  */
@@ -50,10 +53,61 @@ struct irc_message
     char msg[IRC_TRAILING_MAX];
 };
 
+/*
+ * Compact view of a received message, as an alternative to struct irc_message
+ * that avoids copying every token into fixed size buffers.
+ *
+ * Tokens are stored as offset/length pairs into the line the message was
+ * parsed from. Parsing terminates every token within that line, so the
+ * accessors below return plain C strings pointing into it. Missing tokens
+ * point to the line's terminating NUL and thus read as "". A view is only
+ * valid for as long as its line is.
+ */
+struct irc_token
+{
+    uint16_t off;
+    uint16_t len;
+};
+
+struct irc_message_view
+{
+    const char *line;
+
+    enum irc_command command;
+
+    struct irc_token prefix;
+    struct irc_token cmd; /* the command as received */
+    struct irc_token params[IRC_PARAM_COUNT_MAX];
+    int paramcount;
+
+    struct irc_token msg;
+};
+
 /*
  * IRC message handling
  */
 int irc_parse_message(const char *line, struct irc_message *msg);
+
+/*
+ * Parse a line of len bytes (excluding the NUL terminator that has to follow
+ * it) into a view. The line is modified in the process, unless parsing fails.
+ */
+int irc_parse_message_view(char *line,
+                           size_t len,
+                           struct irc_message_view *msg);
+
+const char *irc_view_prefix(const struct irc_message_view *msg);
+const char *irc_view_command(const struct irc_message_view *msg);
+const char *irc_view_param(const struct irc_message_view *msg, int i);
+const char *irc_view_msg(const struct irc_message_view *msg);
+
+/*
+ * Convert a view into a self-contained struct irc_message, for code that needs
+ * to keep a message around or modify it.
+ */
+void irc_message_from_view(struct irc_message *dest,
+                           const struct irc_message_view *src);
+
 void irc_print_message(const struct irc_message *i);
 
 unsigned irc_message_to_string(const struct irc_message *i,
@@ -5,6 +5,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -14,8 +15,16 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+/* A peer that went away should show up as EPIPE, not as a fatal signal */
+#ifdef MSG_NOSIGNAL
+#   define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#   define SOCKET_SEND_FLAGS 0
+#endif
+
 
 const char *socket_addrstr(int fam, struct sockaddr *sa)
 {
@@ -104,9 +113,32 @@ int socket_disconnect(int fd)
     return close(fd);
 }
 
+int socket_set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+        log_perror("fcntl()", LOG_ERROR);
+        return 1;
+    }
+
+    return 0;
+}
+
 ssize_t socket_send(int fd, void *buf, size_t maxsize)
 {
-    return send(fd, buf, maxsize, 0);
+    return send(fd, buf, maxsize, SOCKET_SEND_FLAGS);
+}
+
+ssize_t socket_sendv(int fd, const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+
+    return sendmsg(fd, &msg, SOCKET_SEND_FLAGS);
 }
 
 ssize_t socket_sendall(int fd, void *buf, size_t minsize)
@@ -5,6 +5,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #define SOCKET_SENDFLNBUF_MAX 1024
 #define SOCKET_HOSTNAME_MAX 256
@@ -16,9 +17,14 @@ const char *socket_addrcanon(struct sockaddr *sa, socklen_t len);
 int socket_connect(const char *host, const char *svc);
 int socket_disconnect(int fd);
 
+int socket_set_nonblocking(int fd);
+
 ssize_t socket_send(int fd, void *buf, size_t maxsize);
 ssize_t socket_sendall(int fd, void *buf, size_t minsize);
 
+/* Gather write, sends as much of iov as possible with a single call */
+ssize_t socket_sendv(int fd, const struct iovec *iov, int iovcnt);
+
 ssize_t socket_recv(int fd, void *buf, size_t maxsize);
 ssize_t socket_recvall(int fd, void *buf, size_t minsize);
 
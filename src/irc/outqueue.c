@@ -0,0 +1,333 @@
+#include "irc/outqueue.h"
+#include "util/log.h"
+#include "util/util.h"
+
+#include <string.h>
+
+
+size_t outmsg_format(const struct irc_message *msg, char *dest)
+{
+    /* Leave room for the CRLF, irc_message_to_string() also NUL terminates */
+    size_t len = irc_message_to_string(msg, dest, IRC_MESSAGE_MAX - 2);
+
+    dest[len++] = '\r';
+    dest[len++] = '\n';
+
+    return len;
+}
+
+static struct outmsg *_outmsg_alloc(size_t len)
+{
+    struct outmsg *m = malloc(sizeof(*m) + len);
+
+    if (!m) {
+        log_error("outmsg_new(): not enough memory for allocation");
+        return NULL;
+    }
+
+    memset(m, 0, sizeof(*m));
+
+    m->command = CMD_UNKNOWN;
+    m->len = len;
+
+    return m;
+}
+
+struct outmsg *outmsg_new(const struct irc_message *msg)
+{
+    char buffer[IRC_MESSAGE_MAX];
+    size_t len = outmsg_format(msg, buffer);
+
+    struct outmsg *m = _outmsg_alloc(len);
+
+    if (!m)
+        return NULL;
+
+    memcpy(m->data, buffer, len);
+
+    /* "COMMAND targets :text", as formatted by irc_message_to_string() */
+    if (((msg->command == CMD_PRIVMSG) || (msg->command == CMD_NOTICE))
+            && (msg->paramcount == 1) && (msg->msg[0] != '\0')) {
+        const char *t = msg->params[0];
+
+        m->command = msg->command;
+        m->targets_off = strlen(irc_command_to_string(msg->command)) + 1;
+        m->targets_len = strlen(t);
+        m->text_off = m->targets_off + m->targets_len + 2;
+
+        for (m->ntargets = 1; *t; ++t)
+            if (*t == ',')
+                m->ntargets++;
+
+        /* Text cut off entirely by truncation, leave this one alone */
+        if (m->text_off >= m->len - 2)
+            m->command = CMD_UNKNOWN;
+    }
+
+    return m;
+}
+
+/*
+ * Build "COMMAND targets :text\r\n" from pieces. `text2' is appended to
+ * `text' if given.
+ */
+static struct outmsg *_outmsg_build(enum irc_command command,
+                                    const char *targets, size_t targets_len,
+                                    unsigned ntargets,
+                                    const char *text, size_t text_len,
+                                    const char *text2, size_t text2_len)
+{
+    const char *cmd = irc_command_to_string(command);
+    size_t cmdlen = strlen(cmd);
+
+    size_t len = cmdlen + 1 + targets_len + 2 + text_len + text2_len + 2;
+    struct outmsg *m = NULL;
+    char *p = NULL;
+
+    if ((len > IRC_MESSAGE_MAX) || !(m = _outmsg_alloc(len)))
+        return NULL;
+
+    m->command = command;
+    m->ntargets = ntargets;
+    m->targets_off = cmdlen + 1;
+    m->targets_len = targets_len;
+    m->text_off = m->targets_off + targets_len + 2;
+
+    p = m->data;
+    memcpy(p, cmd, cmdlen);           p += cmdlen;
+    *p++ = ' ';
+    memcpy(p, targets, targets_len);  p += targets_len;
+    *p++ = ' ';
+    *p++ = ':';
+    memcpy(p, text, text_len);        p += text_len;
+    memcpy(p, text2, text2_len);      p += text2_len;
+    *p++ = '\r';
+    *p++ = '\n';
+
+    return m;
+}
+
+static uint64_t _outmsg_later(uint64_t a, uint64_t b)
+{
+    return ((a == 0) || (b == 0)) ? 0 : MAX(a, b);
+}
+
+static size_t _outmsg_text_len(const struct outmsg *m)
+{
+    return m->len - 2 - m->text_off;
+}
+
+/*
+ * Whether target (of length len) is part of the target list of m
+ */
+static int _outmsg_has_target(const struct outmsg *m,
+                              const char *target,
+                              size_t len)
+{
+    const char *p = m->data + m->targets_off;
+    const char *end = p + m->targets_len;
+
+    while (p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *tend = comma ? comma : end;
+
+        if (((size_t)(tend - p) == len) && !memcmp(p, target, len))
+            return 1;
+
+        p = tend + 1;
+    }
+
+    return 0;
+}
+
+struct outmsg *outmsg_add_target(const struct outmsg *queued,
+                                 const struct outmsg *m,
+                                 unsigned maxtargets)
+{
+    char targets[IRC_MESSAGE_MAX];
+    size_t text_len = _outmsg_text_len(queued);
+
+    struct outmsg *merged = NULL;
+
+    if ((queued->command == CMD_UNKNOWN) || (queued->command != m->command))
+        return NULL;
+
+    if ((queued->ntargets + m->ntargets > maxtargets)
+            || (text_len != _outmsg_text_len(m))
+            || memcmp(queued->data + queued->text_off,
+                      m->data + m->text_off, text_len)
+            || (m->ntargets != 1)
+            || _outmsg_has_target(queued,
+                    m->data + m->targets_off, m->targets_len))
+        return NULL;
+
+    if (queued->targets_len + 1 + m->targets_len > sizeof(targets))
+        return NULL;
+
+    memcpy(targets, queued->data + queued->targets_off, queued->targets_len);
+    targets[queued->targets_len] = ',';
+    memcpy(targets + queued->targets_len + 1,
+            m->data + m->targets_off, m->targets_len);
+
+    merged = _outmsg_build(queued->command,
+            targets, queued->targets_len + 1 + m->targets_len,
+            queued->ntargets + m->ntargets,
+            queued->data + queued->text_off, text_len,
+            "", 0);
+
+    if (merged)
+        merged->deadline = _outmsg_later(queued->deadline, m->deadline);
+
+    return merged;
+}
+
+struct outmsg *outmsg_pack(const struct outmsg *queued,
+                           const struct outmsg *m,
+                           const char *sep)
+{
+    char text[IRC_MESSAGE_MAX];
+    size_t seplen = strlen(sep);
+    size_t qlen = _outmsg_text_len(queued);
+
+    struct outmsg *merged = NULL;
+
+    if ((queued->command == CMD_UNKNOWN) || (queued->command != m->command))
+        return NULL;
+
+    if ((queued->targets_len != m->targets_len)
+            || memcmp(queued->data + queued->targets_off,
+                      m->data + m->targets_off, m->targets_len))
+        return NULL;
+
+    if ((queued->data[queued->text_off] == '\001')
+            || (m->data[m->text_off] == '\001'))
+        return NULL;
+
+    if (qlen + seplen > sizeof(text))
+        return NULL;
+
+    memcpy(text, queued->data + queued->text_off, qlen);
+    memcpy(text + qlen, sep, seplen);
+
+    merged = _outmsg_build(queued->command,
+            queued->data + queued->targets_off, queued->targets_len,
+            queued->ntargets,
+            text, qlen + seplen,
+            m->data + m->text_off, _outmsg_text_len(m));
+
+    if (merged)
+        merged->deadline = _outmsg_later(queued->deadline, m->deadline);
+
+    return merged;
+}
+
+void outqueue_init(struct outqueue *q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+void outqueue_clear(struct outqueue *q)
+{
+    struct outmsg *m = NULL;
+
+    while ((m = outqueue_pop(q)))
+        free(m);
+}
+
+void outqueue_push(struct outqueue *q, struct outmsg *m)
+{
+    m->next = NULL;
+
+    if (q->tail)
+        q->tail->next = m;
+    else
+        q->head = m;
+
+    q->tail = m;
+
+    q->count++;
+    q->bytes += m->len;
+}
+
+struct outmsg *outqueue_peek(const struct outqueue *q)
+{
+    return q->head;
+}
+
+struct outmsg *outqueue_pop(struct outqueue *q)
+{
+    struct outmsg *m = q->head;
+
+    if (!m)
+        return NULL;
+
+    if (!(q->head = m->next))
+        q->tail = NULL;
+
+    q->count--;
+    q->bytes -= m->len;
+
+    m->next = NULL;
+    return m;
+}
+
+void outqueue_replace(struct outqueue *q,
+                      struct outmsg *prev,
+                      struct outmsg *old,
+                      struct outmsg *m)
+{
+    m->next = old->next;
+    old->next = NULL;
+
+    if (prev)
+        prev->next = m;
+    else
+        q->head = m;
+
+    if (q->tail == old)
+        q->tail = m;
+
+    q->bytes = q->bytes - old->len + m->len;
+}
+
+void outqueue_remove(struct outqueue *q,
+                     struct outmsg *prev,
+                     struct outmsg *m)
+{
+    if (prev)
+        prev->next = m->next;
+    else
+        q->head = m->next;
+
+    if (q->tail == m)
+        q->tail = prev;
+
+    q->count--;
+    q->bytes -= m->len;
+
+    m->next = NULL;
+}
+
+struct outmsg *outqueue_pop_tail(struct outqueue *q)
+{
+    struct outmsg *m = q->tail;
+    struct outmsg *prev = NULL;
+
+    if (!m)
+        return NULL;
+
+    if (q->head == m)
+        return outqueue_pop(q);
+
+    /* Singly linked, but queues are short */
+    for (prev = q->head; prev->next != m; prev = prev->next)
+        ;
+
+    prev->next = NULL;
+    q->tail = prev;
+
+    q->count--;
+    q->bytes -= m->len;
+
+    return m;
+}
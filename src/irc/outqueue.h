@@ -0,0 +1,106 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include "irc/irc.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * A message ready to be written to the socket.
+ *
+ * Each outgoing message is formatted exactly once, into a record holding the
+ * raw bytes including the terminating CRLF. Everything past that point (flood
+ * protection, queueing and sending) only deals with those bytes.
+ */
+struct outmsg
+{
+    struct outmsg *next;
+
+    /*
+     * For a PRIVMSG or NOTICE with a target list and text, where both are
+     * within data, so queued messages can be merged (see below). command is
+     * CMD_UNKNOWN for any other message.
+     */
+    enum irc_command command;
+    unsigned ntargets;  /* number of comma separated targets */
+    size_t targets_off;
+    size_t targets_len;
+    size_t text_off;    /* text runs up to the CRLF */
+
+    /* CLOCK_MONOTONIC nanoseconds after which sending is pointless, 0 if
+     * the message does not expire */
+    uint64_t deadline;
+
+    size_t len;  /* number of bytes in data, including CRLF */
+    size_t off;  /* number of bytes already written to the socket */
+    char data[]; /* not NUL terminated */
+};
+
+/*
+ * FIFO of formatted messages, only as large as its payload.
+ */
+struct outqueue
+{
+    struct outmsg *head;
+    struct outmsg *tail;
+
+    size_t count; /* number of queued messages */
+    size_t bytes; /* sum of their lengths */
+};
+
+/*
+ * Format msg into dest, which has to hold at least IRC_MESSAGE_MAX bytes.
+ * Overlong messages are truncated so that the CRLF always fits. Returns the
+ * number of bytes written, dest is not NUL terminated.
+ */
+size_t outmsg_format(const struct irc_message *msg, char *dest);
+
+/* Returns NULL if out of memory, release with free() */
+struct outmsg *outmsg_new(const struct irc_message *msg);
+
+/*
+ * Merging of queued messages. Both return a new record that replaces
+ * `queued' and includes `m', or NULL if the two can not be merged within
+ * IRC_MESSAGE_MAX bytes.
+ *
+ * outmsg_add_target() merges messages with identical text into a single one
+ * for the combined target list ("PRIVMSG #a,#b :text"), of no more than
+ * maxtargets targets.
+ *
+ * outmsg_pack() appends the text of m to that of a message for the same
+ * targets, separated by sep. CTCP messages are never packed.
+ *
+ * A merged message expires only once all of its parts would have.
+ */
+struct outmsg *outmsg_add_target(const struct outmsg *queued,
+                                 const struct outmsg *m,
+                                 unsigned maxtargets);
+
+struct outmsg *outmsg_pack(const struct outmsg *queued,
+                           const struct outmsg *m,
+                           const char *sep);
+
+void outqueue_init(struct outqueue *q);
+void outqueue_clear(struct outqueue *q);
+
+void           outqueue_push(struct outqueue *q, struct outmsg *m);
+struct outmsg *outqueue_peek(const struct outqueue *q);
+struct outmsg *outqueue_pop(struct outqueue *q);
+struct outmsg *outqueue_pop_tail(struct outqueue *q);
+
+/*
+ * Put m in place of old, which follows prev (NULL if old is the head).
+ * old is not released.
+ */
+void outqueue_replace(struct outqueue *q,
+                      struct outmsg *prev,
+                      struct outmsg *old,
+                      struct outmsg *m);
+
+/* Unlink m, which follows prev (NULL if m is the head). m is not released. */
+void outqueue_remove(struct outqueue *q,
+                     struct outmsg *prev,
+                     struct outmsg *m);
+
+#endif /* defined OUTQUEUE_H */
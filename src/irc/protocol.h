@@ -35,7 +35,8 @@
     X(PING)       /* <server1> [<server2>] */                                 \
     X(PONG)       /* <server1> [<server2>] */                                 \
     X(ERROR)      /* <error message> */                                       \
-    X(AWAY)       /* [message] */
+    X(AWAY)       /* [message] */                                             \
+    X(CHGHOST)    /* <new user> <new host> */
 
 #define IRC_NUMERICS \
     X(RPL_WELCOME,            1) \
@@ -245,6 +246,8 @@ enum irc_command
 #define X(txt) CMD_ ## txt,
     IRC_COMMANDS
 #undef X
+
+    CMD_UNKNOWN /* anything not listed above */
 };
 
 #endif /* defined PROTOCOL_H */
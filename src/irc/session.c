@@ -2,17 +2,34 @@
 #include "irc/irc.h"
 #include "irc/util.h"
 #include "irc/net/socket.h"
+#include "util/clock.h"
 #include "util/log.h"
 #include "util/util.h"
 
 #include <libutil/container/hashtable.h>
 
-#include <sys/select.h>
+#include <sys/uio.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+
+/* Maximum number of messages handed to the socket at once */
+#define SESS_WRITEV_MAX 64
+
+#define X(prio, capacity, drop) capacity,
+static const size_t _sess_prio_capacity[] = { SESS_PRIORITIES };
+#undef X
+
+#define X(prio, capacity, drop) drop,
+static const enum sess_drop_policy _sess_prio_drop[] = { SESS_PRIORITIES };
+#undef X
+
+static void _sess_on_idle(struct timer *t, void *arg);
+static void _sess_on_timeout(struct timer *t, void *arg);
+static void _sess_on_flood(struct timer *t, void *arg);
 
 
 void sess_init(struct irc_session *sess,
@@ -25,10 +42,20 @@ void sess_init(struct irc_session *sess,
 {
     memset(sess, 0, sizeof(*sess));
 
+    sess->fd = -1;
+
+    timer_init(&sess->idle_timer, _sess_on_idle, sess);
+    timer_init(&sess->timeout_timer, _sess_on_timeout, sess);
+    timer_init(&sess->flood_timer, _sess_on_flood, sess);
+
+    /* Names, prefixes and the keys below, see util/intern.h */
+    intern_init(&sess->strings);
+
+    /* Keyed by folded name, which lives in the channel */
     sess->channels = hashtable_new_with_free(
-            ascii_hash,
-            ascii_equal,
-            free,
+            intern_hash,
+            intern_equal,
+            NULL,
             irc_channel_free);
 
     sess->capabilities = hashtable_new_with_free(
@@ -37,7 +64,15 @@ void sess_init(struct irc_session *sess,
             free,
             free);
 
-    sess->start = time(NULL);
+    /* Users are released by their channels, see irc/channel.h */
+    intern_map_init(&sess->users);
+
+    irc_channel_state_init(sess);
+
+    /* Until the server says otherwise */
+    sess->casemap = irc_casemap(IRC_CASEMAPPING_RFC1459);
+
+    sess->start = clock_time();
 
     strncpy(sess->hostname, server, sizeof(sess->hostname) - 1);
     sess->portno = port;
@@ -48,12 +83,28 @@ void sess_init(struct irc_session *sess,
     strncpy(sess->serverpass, pass, sizeof(sess->serverpass) - 1);
 
     tokenbucket_init(&sess->quota, FLOODPROT_CAPACITY, FLOODPROT_RATE);
+
+    sess->targmax_privmsg = 1;
+    sess->targmax_notice = 1;
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i)
+        fairqueue_init(&sess->buffer_out[i]);
+
+    outqueue_init(&sess->wire);
 }
 
 void sess_destroy(struct irc_session *sess)
 {
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i)
+        fairqueue_destroy(&sess->buffer_out[i]);
+
+    outqueue_clear(&sess->wire);
+
     hashtable_free(sess->channels);
     hashtable_free(sess->capabilities);
+    intern_map_destroy(&sess->users);
+
+    irc_channel_state_destroy(sess);
+    intern_destroy(&sess->strings);
 }
 
 /*
@@ -71,81 +122,394 @@ int sess_capability_set(struct irc_session *sess, const char *cap,
     return 0;
 }
 
-int sess_getln(struct irc_session *sess, char *linebuf, size_t linebufsiz)
+int sess_getln(struct irc_session *sess, char **line, size_t *len)
 {
-    char *crlf = NULL;
+    if (linebuf_getln(&sess->buffer, line, len))
+        return 1;
 
-    if ((crlf = strstr(sess->buffer, "\r\n"))) {
-        size_t len = (size_t)(crlf - sess->buffer);
+    log_debug("<< %s", *line);
+    return 0;
+}
 
-        /* bufuse = buffer usage after line has been taken out */
-        sess->bufuse -= len + 2;
+/*
+ * Pass a message on to the wire queue, and make sure it is written out as soon
+ * as the socket is writable.
+ */
+static void _sess_queue_wire(struct irc_session *sess, struct outmsg *m)
+{
+    log_debug(">> %.*s", (int)(m->len - 2), m->data); /* without CRLF */
 
-        /* Copy line over to line buffer */
-        memset(linebuf, 0, linebufsiz);
-        strncpy(linebuf, sess->buffer, MIN(len, linebufsiz - 1));
+    outqueue_push(&sess->wire, m);
 
-        /* Shift buffer forward, starting from the first byte after \r\n to the
-         * end */
-        memmove(sess->buffer, crlf + 2, sizeof(sess->buffer) - len + 2);
+    if ((sess->wire.count == 1) && sess->reactor)
+        reactor_modify(sess->reactor, sess->fd, REACTOR_READ | REACTOR_WRITE);
+}
 
-        log_debug("<< %s", linebuf);
-        return 0;
+/*
+ * Quota consumed by a message. "Round up" the size to a minimum size, so lots
+ * of tiny messages are still effectively limited
+ */
+static unsigned _sess_msgcost(size_t len)
+{
+    return MAX((unsigned)len, FLOODPROT_MIN);
+}
+
+/*
+ * Wake up as soon as the quota allows a message of the given cost
+ */
+static void _sess_arm_flood(struct irc_session *sess, unsigned cost)
+{
+    uint64_t ns = tokenbucket_wait_ns(&sess->quota, cost);
+
+    if (!sess->reactor || (ns == UINT64_MAX))
+        return;
+
+    /* Round up to whole milliseconds, better late than too early */
+    reactor_schedule(sess->reactor, &sess->flood_timer,
+            (unsigned long)((ns + 999999) / 1000000));
+}
+
+/*
+ * Highest priority queue with anything in it, considering only classes at or
+ * above `lowest'
+ */
+static struct fairqueue *_sess_next_queue(struct irc_session *sess,
+                                         enum sess_priority lowest)
+{
+    for (int i = 0; i <= (int)lowest; ++i)
+        if (sess->buffer_out[i].count > 0)
+            return &sess->buffer_out[i];
+
+    return NULL;
+}
+
+/*
+ * Flood queues are fair between the targets of PRIVMSGs and NOTICEs,
+ * everything else shares a single queue. Targets are folded into key (of
+ * FAIRQUEUE_TARGET_MAX bytes), so "#Foo" and "#foo" share their queue.
+ */
+static const char *_sess_msg_target(const struct irc_session *sess,
+                                    const struct irc_message *msg,
+                                    char *key)
+{
+    if (((msg->command == CMD_PRIVMSG) || (msg->command == CMD_NOTICE))
+            && (msg->paramcount > 0)) {
+        irc_casefold(sess->casemap, key, msg->params[0], FAIRQUEUE_TARGET_MAX);
+        return key;
+    }
+
+    return "";
+}
+
+size_t sess_queue_depth(const struct irc_session *sess, const char *target)
+{
+    char key[FAIRQUEUE_TARGET_MAX];
+    size_t depth = 0;
+
+    irc_casefold(sess->casemap, key, target, sizeof(key));
+
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i)
+        depth += fairqueue_depth(&sess->buffer_out[i], key);
+
+    return depth;
+}
+
+enum sess_priority sess_msg_priority(const struct irc_message *msg)
+{
+    switch (msg->command) {
+    case CMD_PASS:
+    case CMD_NICK:
+    case CMD_USER:
+    case CMD_QUIT:
+    case CMD_JOIN:
+    case CMD_PART:
+    case CMD_WHO:
+    case CMD_PING:
+    case CMD_PONG:
+        return SESS_PRIO_PROTOCOL;
+
+    case CMD_MODE:
+    case CMD_KICK:
+    case CMD_KILL:
+    case CMD_INVITE:
+    case CMD_TOPIC:
+        return SESS_PRIO_MODERATION;
+
+    default:
+        return SESS_PRIO_INTERACTIVE;
     }
+}
+
+static struct outmsg *_sess_merge_target(const struct outmsg *queued,
+                                         const struct outmsg *m,
+                                         const void *arg)
+{
+    return outmsg_add_target(queued, m, *(const unsigned *)arg);
+}
+
+static struct outmsg *_sess_merge_pack(const struct outmsg *queued,
+                                       const struct outmsg *m,
+                                       const void *arg)
+{
+    return outmsg_pack(queued, m, arg);
+}
+
+/*
+ * Try to merge a message that would have to wait into one that already does,
+ * see outmsg_add_target() and outmsg_pack(). Returns 0 if merged.
+ */
+static int _sess_merge(struct irc_session *sess,
+                       struct fairqueue *q,
+                       const char *target,
+                       const struct outmsg *m)
+{
+    unsigned maxtargets = (m->command == CMD_PRIVMSG)
+        ? sess->targmax_privmsg
+        : sess->targmax_notice;
+
+    if (m->command == CMD_UNKNOWN)
+        return 1;
+
+    if ((maxtargets > 1)
+            && !fairqueue_merge_next(q, target, m,
+                                     _sess_merge_target, &maxtargets))
+        return 0;
+
+    if (sess->pack_lines
+            && !fairqueue_merge(q, target, m, _sess_merge_pack,
+                                SESS_PACK_SEPARATOR))
+        return 0;
 
     return 1;
 }
 
-int sess_sendmsg(struct irc_session *sess, const struct irc_message *msg)
+static int _sess_sendmsg(struct irc_session *sess,
+                         const struct irc_message *msg,
+                         enum sess_priority prio,
+                         unsigned ttl)
 {
     struct irc_message msgcopy = *msg;
+    struct outmsg *m = NULL;
+    struct fairqueue *q = &sess->buffer_out[prio];
+
+    const char *target = NULL;
+    char key[FAIRQUEUE_TARGET_MAX];
+
+    /* Would otherwise go out ahead of the login once connected again */
+    if (!sess->connected) {
+        log_warn("Not connected, discarding message");
+        return -1;
+    }
 
     if (sess->cb.on_send_message)
         if (sess->cb.on_send_message(sess->cb.arg, &msgcopy))
             return 0;
 
-    if (sess->buffer_out_start == sess->buffer_out_end) {
-        /* Buffer empty, try to send immediately */
-        unsigned msglen = irc_message_size(&msgcopy) + 2; /* \r\n */
+    if (!(m = outmsg_new(&msgcopy)))
+        return -1;
 
-        /* "Round up" the size to a minimum size, so lots of tiny messages
-         * are still effectively limited */
-        msglen = MAX(MIN(msglen, IRC_MESSAGE_MAX), FLOODPROT_MIN);
+    if (ttl)
+        m->deadline = clock_mono_ns() + (uint64_t)ttl * UINT64_C(1000000);
 
-        if (tokenbucket_consume(&sess->quota, msglen))
-            /* Buffer is empty and enough quota is left, send for realsies */
-            return sess_sendmsg_real(sess, &msgcopy);
+    if (!_sess_next_queue(sess, prio)) {
+        /* Nothing of the same or higher priority waiting, try to send
+         * immediately */
+        tokenbucket_generate(&sess->quota);
 
-        /* Not enough quota left, drop down and push into queue */
-    } else if (((sess->buffer_out_end + 1) % FLOODPROT_BUFFER)
-            == sess->buffer_out_end) {
-        /* Buffer is full! Discard. */
-        log_warn("Flood protection: Outgoing buffer full, discarding message!");
-        return -1;
+        if (tokenbucket_consume(&sess->quota, _sess_msgcost(m->len))) {
+            /* Enough quota is left, send for realsies */
+            _sess_queue_wire(sess, m);
+            return 1;
+        }
+    }
+
+    target = _sess_msg_target(sess, &msgcopy, key);
+
+    if (!_sess_merge(sess, q, target, m)) {
+        log_debug("Flood protection: message merged into a queued one");
+        sess->stats.merged++;
+
+        free(m);
+        goto rearm;
     }
 
-    /* Buffer is neither empty nor full or message could not be sent. Append it
-     * to the buffer */
+    if (q->count >= _sess_prio_capacity[prio]) {
+        /*
+         * Expired messages only leave the queue once they reach its head, get
+         * rid of them before anything still worth sending is dropped
+         */
+        size_t expired = fairqueue_expire(q, clock_mono_ns());
+
+        if (expired) {
+            log_debug("Flood protection: discarded %zu expired messages",
+                    expired);
+            sess->stats.expired += expired;
+        }
+    }
+
+    if (q->count >= _sess_prio_capacity[prio]) {
+        /*
+         * Room is always made at the expense of the target with the most
+         * messages queued, so one busy target can not crowd out the others.
+         */
+        int newest = (_sess_prio_drop[prio] == SESS_DROP_NEWEST);
+
+        if (newest && (fairqueue_depth(q, target)
+                    >= fairqueue_deepest(q)->queue.count)) {
+            log_warn("Flood protection: Outgoing buffer full, "
+                     "discarding message!");
+            sess->stats.dropped++;
+
+            free(m);
+            return -1;
+        }
+
+        log_warn("Flood protection: Outgoing buffer full, "
+                 "discarding %s message for `%s'!",
+                 newest ? "newest" : "oldest", fairqueue_deepest(q)->name);
+        sess->stats.dropped++;
+
+        free(fairqueue_evict(q, newest));
+    }
+
+    /* Message could not be sent. Append it to the buffer of its class */
     log_warn("Flood protection: message queued for later delivery");
-    sess->buffer_out[sess->buffer_out_end] = msgcopy;
-    sess->buffer_out_end = (sess->buffer_out_end + 1) % FLOODPROT_BUFFER;
+    sess->stats.queued++;
+    fairqueue_push(q, target, m);
+
+rearm:
+    /* The next message to go out may have changed, wake up in time for it */
+    q = _sess_next_queue(sess, SESS_PRIO_COUNT - 1);
+    _sess_arm_flood(sess, _sess_msgcost(fairqueue_peek(q)->len));
 
     return 0;
 }
 
+int sess_sendmsg(struct irc_session *sess, const struct irc_message *msg)
+{
+    return _sess_sendmsg(sess, msg, sess_msg_priority(msg), sess->send_ttl);
+}
+
+int sess_sendmsg_prio(struct irc_session *sess,
+                      const struct irc_message *msg,
+                      enum sess_priority prio)
+{
+    return _sess_sendmsg(sess, msg, prio, sess->send_ttl);
+}
+
+int sess_sendmsg_ttl(struct irc_session *sess,
+                     const struct irc_message *msg,
+                     unsigned ttl)
+{
+    return _sess_sendmsg(sess, msg, sess_msg_priority(msg), ttl);
+}
+
 int sess_sendmsg_real(struct irc_session *sess, const struct irc_message *msg)
 {
-    char buffer[IRC_MESSAGE_MAX] = {0};
+    struct outmsg *m = outmsg_new(msg);
+
+    if (!m)
+        return 0;
+
+    _sess_queue_wire(sess, m);
+    return 1;
+}
+
+int sess_flush(struct irc_session *sess)
+{
+    struct fairqueue *q = NULL;
+    uint64_t now = clock_mono_ns();
+
+    tokenbucket_generate(&sess->quota);
+
+    /* Strictly by priority, a lower class never overtakes a higher one.
+     * Within a class, targets take turns. */
+    while ((q = _sess_next_queue(sess, SESS_PRIO_COUNT - 1))) {
+        struct outmsg *next = fairqueue_peek(q);
+
+        if (next->deadline && (next->deadline <= now)) {
+            /* Too late to be of any use, don't waste quota on it */
+            log_debug("Flood protection: discarding expired message");
+            sess->stats.expired++;
+
+            free(fairqueue_pop(q));
+            continue;
+        }
+
+        if (!tokenbucket_consume(&sess->quota, _sess_msgcost(next->len)))
+            break;
+
+        _sess_queue_wire(sess, fairqueue_pop(q));
+    }
+
+    /* Still something left? Try again once enough tokens have been
+     * generated for the next message */
+    if (q)
+        _sess_arm_flood(sess, _sess_msgcost(fairqueue_peek(q)->len));
+
+    return 0;
+}
+
+int sess_write(struct irc_session *sess)
+{
+    struct iovec iov[SESS_WRITEV_MAX];
+
+    while (sess->wire.count > 0) {
+        struct outmsg *m = NULL;
+        int n = 0;
+
+        ssize_t out;
+
+        for (m = outqueue_peek(&sess->wire);
+                m && (n < SESS_WRITEV_MAX); m = m->next, ++n) {
+            iov[n].iov_base = m->data + m->off;
+            iov[n].iov_len = m->len - m->off;
+        }
+
+        if ((out = socket_sendv(sess->fd, iov, n)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+
+            log_error("Unable to send data: %s", strerror(errno));
+            return -1;
+        }
+
+        /* Retire everything that went out, remember where a partial write
+         * stopped */
+        while ((out > 0) && (m = outqueue_peek(&sess->wire))) {
+            size_t left = m->len - m->off;
+
+            if ((size_t)out < left) {
+                m->off += (size_t)out;
+                break;
+            }
+
+            out -= (ssize_t)left;
+            free(outqueue_pop(&sess->wire));
+        }
+
+        /* Socket buffer is full, wait for it to drain */
+        if (outqueue_peek(&sess->wire) && outqueue_peek(&sess->wire)->off)
+            break;
+    }
 
-    irc_message_to_string(msg, buffer, sizeof(buffer));
-    log_debug(">> %s", buffer);
+    if ((sess->wire.count == 0) && sess->reactor)
+        reactor_modify(sess->reactor, sess->fd, REACTOR_READ);
 
-    return socket_sendfln(sess->fd, "%s", buffer) > 0;
+    return 0;
 }
 
 int sess_connect(struct irc_session *sess)
 {
-    return ((sess->fd = socket_connect(sess->hostname, itoa(sess->portno))));
+    sess->fd = socket_connect(sess->hostname, itoa(sess->portno));
+
+    /* Resolving and connecting block, time has passed */
+    clock_update();
+
+    return sess->fd;
 }
 
 int sess_disconnect(struct irc_session *sess)
@@ -159,94 +523,172 @@ int sess_disconnect(struct irc_session *sess)
  */
 int sess_main(struct irc_session *sess)
 {
+    struct reactor reactor;
+
+    if (reactor_init(&reactor, NULL))
+        return 1;
+
     /* Jump into mainloop */
     while (!sess->kill) {
-        time_t lastidle = time(NULL);
-        time_t last_sign_of_life = time(NULL);
-
-        if (sess_connect(sess) < 0)
+        if (sess_attach(sess, &reactor))
             break;
 
-        sess->session_start = time(NULL);
-        sess_login(sess);
-
         /* Inner loop, receive and handle data */
-        while (!sess->kill) {
-            /*
-             * Since both idle and flood protection are based on second
-             * precision, this is an optimal timeout
-             */
-            struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+        while (!sess->kill && sess->connected)
+            if (reactor_poll(&reactor, -1) < 0) {
+                log_perror("reactor_poll()", LOG_ERROR);
+                break;
+            }
 
-            int res = sess_handle_data(sess, &timeout);
+        sess_detach(sess);
+    }
 
-            if (res < 0) {
-                break;
-            } else if (res > 0) {
-                last_sign_of_life = time(NULL);
-            } else {
-                if ((time(NULL) - last_sign_of_life) >= TIMEOUT) {
-                    struct tm *tm = TIME_GETTIME(&last_sign_of_life);
+    reactor_destroy(&reactor);
 
-                    char buffer[TIMEBUF_MAX] = {0};
-                    strftime(buffer, sizeof(buffer), STRFTIME_FORMAT, tm);
+    return 0;
+}
 
-                    log_info("Last sign of life was %d seconds "
-                             "ago (%s). Pinging server...",
-                                time(NULL) - last_sign_of_life, buffer);
+static void _sess_on_io(struct reactor *r, int fd, unsigned events, void *arg)
+{
+    struct irc_session *sess = arg;
 
-                    struct irc_message ping;
-                    irc_mkmessage(&ping, CMD_PING, NULL, 0, "%s",
-                        sess->hostname);
+    if (events & REACTOR_WRITE)
+        if (sess_write(sess) < 0) {
+            sess->connected = 0;
+            return;
+        }
 
-                    if (sess_sendmsg_real(sess, &ping) <= 0)
-                        break;
-                }
-            }
+    /* Errors and hangups are picked up by the next read */
+    if (events & (REACTOR_READ | REACTOR_ERROR)) {
+        int res = sess_handle_data(sess);
 
-            /* Try to send messages in outbuffer */
-            while (sess->buffer_out_start != sess->buffer_out_end) {
-                struct irc_message *next =
-                    &(sess->buffer_out[sess->buffer_out_start]);
+        if (res < 0)
+            sess->connected = 0;
+        else if (res > 0)
+            sess->last_sign_of_life = clock_time();
+    }
+}
 
-                unsigned len = irc_message_size(next);
-                len = MAX(len, FLOODPROT_MIN);
+static void _sess_on_idle(struct timer *t, void *arg)
+{
+    struct irc_session *sess = arg;
 
-                if (tokenbucket_consume(&sess->quota, len)) {
-                    sess_sendmsg_real(sess, next);
+    reactor_schedule(sess->reactor, t, IDLE_INTERVAL * 1000);
 
-                    sess->buffer_out_start =
-                        (sess->buffer_out_start + 1) % FLOODPROT_BUFFER;
-                } else {
-                    break;
-                }
-            }
+    if (sess->cb.on_idle)
+        sess->cb.on_idle(sess->cb.arg, sess->lastidle);
 
-            /* Check if we have to emit an idle event */
-            if ((time(NULL) - lastidle) >= IDLE_INTERVAL) {
-                if (sess->cb.on_idle)
-                    sess->cb.on_idle(sess->cb.arg, lastidle);
+    sess->lastidle = clock_time();
+}
 
-                lastidle = time(NULL);
-            }
+static void _sess_on_timeout(struct timer *t, void *arg)
+{
+    struct irc_session *sess = arg;
+    time_t silence = clock_time() - sess->last_sign_of_life;
 
-            /* And regenerate some tokens */
-            tokenbucket_generate(&sess->quota);
-        }
+    if (silence < TIMEOUT) {
+        /* Data arrived in the meantime, check again when it may have gone
+         * stale */
+        reactor_schedule(sess->reactor, t, (TIMEOUT - silence) * 1000);
+    } else {
+        struct tm *tm = TIME_GETTIME(&sess->last_sign_of_life);
+        struct irc_message ping;
 
-        if (sess->cb.on_disconnect)
-            sess->cb.on_disconnect(sess->cb.arg);
+        char buffer[TIMEBUF_MAX] = {0};
+        strftime(buffer, sizeof(buffer), STRFTIME_FORMAT, tm);
 
-        /* Session is finished, free resources and start again unless killed */
-        hashtable_clear(sess->channels);
-        hashtable_clear(sess->capabilities);
+        log_info("Last sign of life was %d seconds "
+                 "ago (%s). Pinging server...", silence, buffer);
 
-        sess_disconnect(sess);
+        irc_mkmessage(&ping, CMD_PING, NULL, 0, "%s", sess->hostname);
+
+        if (sess_sendmsg_real(sess, &ping) <= 0)
+            sess->connected = 0;
+        else
+            reactor_schedule(sess->reactor, t, TIMEOUT * 1000);
     }
+}
+
+static void _sess_on_flood(struct timer *t, void *arg)
+{
+    sess_flush(arg);
+}
+
+int sess_attach(struct irc_session *sess, struct reactor *r)
+{
+    if (sess_connect(sess) < 0)
+        return 1;
+
+    sess->reactor = r;
+    linebuf_init(&sess->buffer);
+
+    /* Nothing left over from before belongs to the new connection */
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i)
+        fairqueue_clear(&sess->buffer_out[i]);
+
+    outqueue_clear(&sess->wire);
+
+    /* Until the server tells otherwise */
+    sess->targmax_privmsg = 1;
+    sess->targmax_notice = 1;
+
+    if (socket_set_nonblocking(sess->fd)
+            || reactor_add(r, sess->fd, REACTOR_READ, _sess_on_io, sess)) {
+        log_error("Unable to register session with event loop");
+
+        sess_detach(sess);
+        return 1;
+    }
+
+    sess->connected = 1;
+    sess->session_start = clock_time();
+    sess->lastidle = clock_time();
+    sess->last_sign_of_life = clock_time();
+
+    reactor_schedule(r, &sess->idle_timer, IDLE_INTERVAL * 1000);
+    reactor_schedule(r, &sess->timeout_timer, TIMEOUT * 1000);
+
+    sess_login(sess);
 
     return 0;
 }
 
+void sess_detach(struct irc_session *sess)
+{
+    if (sess->connected && sess->cb.on_disconnect)
+        sess->cb.on_disconnect(sess->cb.arg);
+
+    /* Last chance for anything still pending, e.g. a QUIT */
+    if (sess->connected)
+        sess_write(sess);
+
+    sess->connected = 0;
+
+    /* Session is finished, free resources */
+    hashtable_clear(sess->channels);
+    hashtable_clear(sess->capabilities);
+
+    sess->casemap = irc_casemap(IRC_CASEMAPPING_RFC1459);
+    for (int i = 0; i < SESS_PRIO_COUNT; ++i)
+        fairqueue_clear(&sess->buffer_out[i]);
+
+    outqueue_clear(&sess->wire);
+
+    if (sess->reactor) {
+        reactor_cancel(sess->reactor, &sess->idle_timer);
+        reactor_cancel(sess->reactor, &sess->timeout_timer);
+        reactor_cancel(sess->reactor, &sess->flood_timer);
+
+        reactor_remove(sess->reactor, sess->fd);
+    }
+
+    if (sess->fd >= 0)
+        sess_disconnect(sess);
+
+    sess->fd = -1;
+    sess->reactor = NULL;
+}
+
 int sess_login(struct irc_session *sess)
 {
     struct irc_message nick;
@@ -272,60 +714,62 @@ int sess_login(struct irc_session *sess)
 }
 
 /*
- *  Waits for data on the socket, return value indicates one of three results:
+ *  Reads data from the socket once it is readable, return value indicates one
+ *  of three results:
  *  < 0: error
  *  > 0: number of bytes received (success)
- *    0: timeout while waiting
+ *    0: spurious wakeup, nothing received
  */
-int sess_handle_data(struct irc_session *sess, struct timeval *timeout)
+int sess_handle_data(struct irc_session *sess)
 {
-    fd_set reads;
+    struct irc_message_view msg;
 
-    FD_ZERO(&reads);
-    FD_SET(sess->fd, &reads);
+    char *line = NULL;
+    size_t len = 0;
 
-    int nfds = select(sess->fd + 1, &reads, NULL, NULL, timeout);
+    char *dst = NULL;
+    size_t avail = linebuf_reserve(&sess->buffer, &dst);
 
-    if ((nfds > 0) && (FD_ISSET(sess->fd, &reads))) {
-        struct irc_message msg;
-        char line[IRC_MESSAGE_MAX] = {0};
+    ssize_t data = socket_recv(sess->fd, dst, avail);
 
-        ssize_t data = socket_recv(
-                        sess->fd,
-                        sess->buffer + sess->bufuse,
-                        sizeof(sess->buffer) - sess->bufuse - 1);
+    if ((data < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+                                         || (errno == EINTR)))
+        return 0;
 
-        if (data <= 0) {
-            if (data == 0)
-                log_info("Server closed connection");
-            else
-                log_error("Connection terminated unexpectedly: %s",
-                        strerror(errno));
+    if (data <= 0) {
+        if (data == 0)
+            log_info("Server closed connection");
+        else
+            log_error("Connection terminated unexpectedly: %s",
+                    strerror(errno));
 
-            return -1;
-        }
+        return -1;
+    }
 
-        sess->bufuse += (size_t)data;
+    linebuf_commit(&sess->buffer, (size_t)data);
 
-        /*
-         * While the last blob of data received contains a full line,
-         * process it
-         */
-        while (!sess_getln(sess, line, sizeof(line))) {
-            if (!irc_parse_message(line, &msg)) {
-                if (sess_handle_message(sess, &msg)) {
-                    log_warn("message handler returned failure -- abort!");
-                    return -1;
-                }
-            } else {
-                log_warn("Failed to parse line '%s'", line);
+    /*
+     * While the last blob of data received contains a full line,
+     * process it
+     */
+    while (!sess_getln(sess, &line, &len)) {
+        if (sess->capture)
+            capture_write(sess->capture, clock_mono_ns(), line, len);
+
+        if (!irc_parse_message_view(line, len, &msg)) {
+            if (sess_handle_message(sess, &msg)) {
+                log_warn("message handler returned failure -- abort!");
+                return -1;
             }
+        } else {
+            log_warn("Failed to parse line '%s'", line);
         }
-
-        return data;
     }
 
-    return 0;
+    if (sess->capture)
+        capture_flush(sess->capture);
+
+    return data;
 }
 
 
@@ -357,15 +801,34 @@ int sess_handle_data(struct irc_session *sess, struct timeval *timeout)
             irc_command_to_string(dom), (e), (h));
 
 
-int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
+/*
+ * Whether a nick or prefix is our own, under the server's case mapping
+ */
+static int _sess_is_me(struct irc_session *sess, const char *prefix)
+{
+    char key[IRC_NICK_MAX];
+    char own[IRC_NICK_MAX];
+
+    irc_user_key(sess, key, prefix);
+    irc_user_key(sess, own, sess->nick);
+
+    return !strcmp(key, own);
+}
+
+int sess_handle_message(struct irc_session *sess,
+                        const struct irc_message_view *msg)
 {
+    /* Tokens are terminated in place, so these are plain C strings */
+    const char *prefix = irc_view_prefix(msg);
+    const char *trailing = irc_view_msg(msg);
+
     if (sess->cb.on_event)
         sess->cb.on_event(sess->cb.arg, msg);
 
     if (msg->command == CMD_PING) {
         struct irc_message pong;
 
-        irc_mkmessage(&pong, CMD_PONG, NULL, 0, "%s", msg->msg);
+        irc_mkmessage(&pong, CMD_PONG, NULL, 0, "%s", trailing);
         sess_sendmsg(sess, &pong);
 
         if (sess->cb.on_ping)
@@ -380,15 +843,17 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
         char *eq = NULL;
 
         for (int i = 1; i < msg->paramcount; ++i) {
-            memcpy(capability, msg->params[i], sizeof(capability));
+            /* The view is read-only, split a copy at the '=' */
+            strncpy(capability, irc_view_param(msg, i), sizeof(capability) - 1);
+            capability[sizeof(capability) - 1] = '\0';
 
-            if (!(eq = strchr(msg->params[i], '='))) {
-                sess_capability_set(sess, msg->params[i], NULL);
-                sess_handle_isupport(sess, msg->params[i], NULL);
+            if (!(eq = strchr(capability, '='))) {
+                sess_capability_set(sess, capability, NULL);
+                sess_handle_isupport(sess, capability, NULL);
             } else {
                 *eq = '\0';
-                sess_capability_set(sess, msg->params[i], eq + 1);
-                sess_handle_isupport(sess, msg->params[i], eq + 1);
+                sess_capability_set(sess, capability, eq + 1);
+                sess_handle_isupport(sess, capability, eq + 1);
             }
         }
     } else if (msg->command == RPL_TOPIC) {
@@ -396,10 +861,10 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
 
         CHECK_ARGC(2, msg);
 
-        if ((target = irc_channel_get(sess, msg->params[1])))
-            irc_channel_set_topic(target, msg->msg);
+        if ((target = irc_channel_get(sess, irc_view_param(msg, 1))))
+            irc_channel_set_topic(target, trailing);
         else
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[1]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 1));
 
 
     } else if (msg->command == RPL_TOPICWHOTIME) {
@@ -408,53 +873,56 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
 
         CHECK_ARGC(4, msg);
 
-        if ((target = irc_channel_get(sess, msg->params[1])))
+        if ((target = irc_channel_get(sess, irc_view_param(msg, 1))))
             irc_channel_set_topic_meta(target,
-                msg->params[2], atoi(msg->params[3]));
+                irc_view_param(msg, 2), atoi(irc_view_param(msg, 3)));
         else
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[1]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 1));
 
 
     } else if (msg->command == RPL_CHANNELMODEIS) {
         CHECK_ARGC(3, msg);
 
         sess_handle_mode_change(sess,
-                msg->prefix,
-                msg->params[1], /* channel */
-                msg->params[2], /* modestring */
-                msg->params, 3, msg->paramcount); /* param start and end */
+                prefix,
+                irc_view_param(msg, 1), /* channel */
+                irc_view_param(msg, 2), /* modestring */
+                msg, 3); /* first mode argument */
 
     } else if (msg->command == RPL_CREATIONTIME) {
         struct irc_channel *target = NULL;
 
         CHECK_ARGC(3, msg);
 
-        if ((target = irc_channel_get(sess, msg->params[1])))
-            irc_channel_set_created(target, atoi(msg->params[2]));
+        if ((target = irc_channel_get(sess, irc_view_param(msg, 1))))
+            irc_channel_set_created(target, atoi(irc_view_param(msg, 2)));
         else
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[1]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 1));
 
 
     } else if (msg->command == RPL_WHOREPLY) {
         struct irc_channel *channel = NULL;
 
+        const char *nick = NULL;
+        const char *modes = NULL;
+
         CHECK_ARGC(7, msg);
 
-        if ((channel = irc_channel_get(sess, msg->params[1]))) {
-            struct irc_user *user = NULL;
+        nick = irc_view_param(msg, 5);
+        modes = irc_view_param(msg, 6);
 
-            if (!(user = irc_channel_get_user(channel, msg->params[5])))  {
-                const char *prf = sess_capability_get(sess, "PREFIX");
-                size_t prfsep = strlen(prf) / 2;
+        if ((channel = irc_channel_get(sess, irc_view_param(msg, 1)))) {
+            struct irc_member *user = NULL;
 
-                char prefix[IRC_PREFIX_MAX] = {0};
+            if (!(user = irc_channel_get_user(channel, nick)))  {
+                char uprefix[IRC_PREFIX_MAX] = {0};
 
-                snprintf(prefix, sizeof(prefix), "%s!%s@%s",
-                        msg->params[5], msg->params[2], msg->params[3]);
+                snprintf(uprefix, sizeof(uprefix), "%s!%s@%s", nick,
+                        irc_view_param(msg, 2), irc_view_param(msg, 3));
 
-                irc_channel_add_user(channel, prefix);
-                if (!(user = irc_channel_get_user(channel, prefix))) {
-                    log_wtf("Newly added user '%s' not found", msg->params[5]);
+                irc_channel_add_user(channel, uprefix);
+                if (!(user = irc_channel_get_user(channel, uprefix))) {
+                    log_wtf("Newly added user '%s' not found", nick);
 
                     goto exit_err;
                 }
@@ -463,28 +931,48 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
                  * Go over every flag within the users mode string and match
                  * them against the server's PREFIX to get the actual mode.
                  */
-                for (size_t i = 0; i < strlen(msg->params[6]); ++i)
-                    for (size_t j = 0; j < prfsep - 1; ++j)
-                        if (msg->params[6][i] == prf[prfsep + j + 1])
-                            irc_channel_user_set_mode(user, prf[j + 1]);
+                for (const char *f = modes; *f; ++f) {
+                    const char *sym = strchr(sess->userprefixes, *f);
+
+                    if (sym)
+                        irc_channel_user_set_mode(user,
+                            sess->usermodes[sym - sess->userprefixes]);
+                }
             } else {
                 log_warn("%s: User '%s' already in channel",
-                        irc_command_to_string(msg->command), msg->params[5]);
+                        irc_command_to_string(msg->command), nick);
             }
         } else {
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[1]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 1));
         }
 
 
-    } else if (msg->command == RPL_BANLIST) {
+    } else if ((msg->command == RPL_BANLIST)
+            || (msg->command == RPL_EXCEPTLIST)
+            || (msg->command == RPL_INVITELIST)) {
         struct irc_channel *channel = NULL;
 
+        /* Setter and time are optional */
+        const char *setter = NULL;
+        time_t set = 0;
+
+        char mode = (msg->command == RPL_BANLIST)    ? 'b'
+                  : (msg->command == RPL_EXCEPTLIST) ? 'e'
+                  :                                    'I';
+
         CHECK_ARGC(3, msg);
 
-        if ((channel = irc_channel_get(sess, msg->params[1])))
-            irc_channel_set_mode(channel, 'b', msg->params[2]);
+        if (msg->paramcount > 3)
+            setter = irc_view_param(msg, 3);
+
+        if (msg->paramcount > 4)
+            set = atoi(irc_view_param(msg, 4));
+
+        if ((channel = irc_channel_get(sess, irc_view_param(msg, 1))))
+            irc_channel_set_mode(channel, mode, irc_view_param(msg, 2),
+                    setter, set);
         else
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[1]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 1));
 
 
     } else if (msg->command == RPL_ENDOFMOTD) {
@@ -495,33 +983,34 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
 
         if (sess->cb.on_privmsg)
             sess->cb.on_privmsg(sess->cb.arg,
-                    msg->prefix, msg->params[0], msg->msg);
+                    prefix, irc_view_param(msg, 0), trailing);
 
     } else if (msg->command == CMD_NOTICE) {
         CHECK_ARGC(1, msg);
 
         if (sess->cb.on_notice)
             sess->cb.on_notice(sess->cb.arg,
-                    msg->prefix, msg->params[0], msg->msg);
+                    prefix, irc_view_param(msg, 0), trailing);
 
     } else if (msg->command == CMD_JOIN) {
-        if (!irc_user_cmp(msg->prefix, sess->nick)) {
+        /* Some servers send the channel as the trailing parameter */
+        const char *chan = (msg->paramcount > 0)
+            ? irc_view_param(msg, 0)
+            : trailing;
+
+        if (_sess_is_me(sess, prefix)) {
             struct irc_message who;
             struct irc_message mode;
             struct irc_message bans;
 
-            const char *channel = msg->paramcount > 0
-                ? msg->params[0]
-                : msg->msg;
-
-            irc_channel_add(sess, channel);
+            irc_channel_add(sess, chan);
 
             irc_mkmessage(&who, CMD_WHO,
-                    (const char *[]){ channel }, 1, NULL);
+                    (const char *[]){ chan }, 1, NULL);
             irc_mkmessage(&mode, CMD_MODE,
-                    (const char *[]){ channel }, 1, NULL);
+                    (const char *[]){ chan }, 1, NULL);
             irc_mkmessage(&bans, CMD_MODE,
-                    (const char *[]){ channel, "+b" }, 2, NULL);
+                    (const char *[]){ chan, "+b" }, 2, NULL);
 
             sess_sendmsg(sess, &who);
             sess_sendmsg(sess, &mode);
@@ -529,14 +1018,14 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
         } else {
             struct irc_channel *channel = NULL;
 
-            if ((channel = irc_channel_get(sess, msg->params[0])))
-                irc_channel_add_user(channel, msg->prefix);
+            if ((channel = irc_channel_get(sess, chan)))
+                irc_channel_add_user(channel, prefix);
             else
-                WARN_UNKNOWN_CHAN(msg->command, msg->params[0]);
+                WARN_UNKNOWN_CHAN(msg->command, chan);
         }
 
         if (sess->cb.on_join)
-            sess->cb.on_join(sess->cb.arg, msg->prefix, msg->params[0]);
+            sess->cb.on_join(sess->cb.arg, prefix, chan);
 
     } else if (msg->command == CMD_PART) {
         struct irc_channel *target = NULL;
@@ -545,21 +1034,21 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
 
         if (sess->cb.on_part)
             sess->cb.on_part(sess->cb.arg,
-                msg->prefix, msg->params[0], msg->msg);
+                prefix, irc_view_param(msg, 0), trailing);
 
-        if ((target = irc_channel_get(sess, msg->params[0]))) {
-            if (!irc_user_cmp(msg->prefix, sess->nick)) {
+        if ((target = irc_channel_get(sess, irc_view_param(msg, 0)))) {
+            if (_sess_is_me(sess, prefix)) {
                 irc_channel_del(sess, target);
             } else {
-                struct irc_user *usr = NULL;
+                struct irc_member *usr = NULL;
 
-                if ((usr = irc_channel_get_user(target, msg->prefix)))
+                if ((usr = irc_channel_get_user(target, prefix)))
                     irc_channel_del_user(target, usr);
                 else
-                    WARN_UNKNOWN_CHUSER(msg->command, target, msg->prefix);
+                    WARN_UNKNOWN_CHUSER(msg->command, target, prefix);
             }
         } else {
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[0]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 0));
         }
 
     } else if (msg->command == CMD_KICK) {
@@ -567,90 +1056,92 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
 
         CHECK_ARGC(2, msg);
 
-        if ((target =  irc_channel_get(sess, msg->params[0]))) {
-            struct irc_user *utarget = NULL;
+        if ((target =  irc_channel_get(sess, irc_view_param(msg, 0)))) {
+            struct irc_member *utarget = NULL;
 
-            if ((utarget = irc_channel_get_user(target, msg->params[1]))) {
+            if ((utarget = irc_channel_get_user(target,
+                            irc_view_param(msg, 1)))) {
                 if (sess->cb.on_kick)
                     sess->cb.on_kick(sess->cb.arg,
-                                     msg->prefix,
-                                     utarget->prefix,
-                                     msg->params[0],
-                                     msg->msg);
+                                     prefix,
+                                     utarget->user->prefix,
+                                     irc_view_param(msg, 0),
+                                     trailing);
 
-                if (!irc_user_cmp(msg->params[1], sess->nick))
+                if (_sess_is_me(sess, irc_view_param(msg, 1)))
                     irc_channel_del(sess, target);
                 else
                     irc_channel_del_user(target, utarget);
             } else {
-                WARN_UNKNOWN_CHUSER(msg->command, target, msg->params[1]);
+                WARN_UNKNOWN_CHUSER(msg->command, target,
+                        irc_view_param(msg, 1));
             }
         } else {
-            WARN_UNKNOWN_CHAN(msg->command, msg->params[0]);
+            WARN_UNKNOWN_CHAN(msg->command, irc_view_param(msg, 0));
         }
 
 
     } else if (msg->command == CMD_QUIT) {
-        if (sess->cb.on_quit)
-            sess->cb.on_quit(sess->cb.arg, msg->prefix, msg->msg);
-
-        struct hashtable_iterator iter;
-        void *k = NULL;
-        void *v = NULL;
+        struct irc_user *usr = NULL;
 
-        hashtable_iterator_init(&iter, sess->channels);
-        while (hashtable_iterator_next(&iter, &k, &v)) {
-            struct irc_user *usr = irc_channel_get_user(v, msg->prefix);
+        if (sess->cb.on_quit)
+            sess->cb.on_quit(sess->cb.arg, prefix, trailing);
 
-            if (usr)
-                irc_channel_del_user(v, usr);
-        }
+        if ((usr = irc_user_get(sess, prefix)))
+            irc_user_del(sess, usr);
 
     } else if (msg->command == CMD_NICK) {
         struct irc_user *user = NULL;
-        const char *newnick = msg->paramcount > 0
-            ? msg->params[0]
-            : msg->msg;
+        const char *newnick = (msg->paramcount > 0)
+            ? irc_view_param(msg, 0)
+            : trailing;
 
-        /* TODO: Move this into irc_channel_rename_user? */
-        char *oldpostfix = NULL;
+        const char *oldpostfix = NULL;
         char newprefix[IRC_PREFIX_MAX] = {0};
         char oldprefix[IRC_PREFIX_MAX] = {0};
 
-        if (!irc_user_cmp(msg->prefix, sess->nick)) {
+        if (_sess_is_me(sess, prefix)) {
             memset(sess->nick, 0, sizeof(sess->nick));
             strncpy(sess->nick, newnick, sizeof(sess->nick) - 1);
         }
 
         /* Check for a valid prefix before proceeding. */
-        if ((oldpostfix = strchr(msg->prefix, '!')) != NULL) {
-            strncpy(oldprefix, msg->prefix, sizeof(oldprefix) - 1);
+        if ((oldpostfix = strchr(prefix, '!')) != NULL) {
+            strncpy(oldprefix, prefix, sizeof(oldprefix) - 1);
             strncat(newprefix, newnick, sizeof(newprefix) - 1);
             strncat(newprefix, oldpostfix, sizeof(newprefix) - 1);
 
-            struct hashtable_iterator iter;
-            void *k = NULL;
-            void *v = NULL;
-
-            hashtable_iterator_init(&iter, sess->channels);
-            while (hashtable_iterator_next(&iter, &k, &v))
-                if ((user = irc_channel_get_user(v, msg->prefix)))
-                    irc_channel_rename_user(v, user, newprefix);
+            if ((user = irc_user_get(sess, prefix)))
+                irc_user_set_prefix(sess, user, newprefix);
 
             if (sess->cb.on_nick)
                 sess->cb.on_nick(sess->cb.arg, oldprefix, newprefix);
         } else {
-            log_warn("Invalid user prefix: `%s'", msg->prefix);
+            log_warn("Invalid user prefix: `%s'", prefix);
         }
 
+    } else if (msg->command == CMD_CHGHOST) {
+        struct irc_user *user = NULL;
+        char newprefix[IRC_PREFIX_MAX] = {0};
+
+        CHECK_ARGC(2, msg);
+
+        snprintf(newprefix, sizeof(newprefix), "%.*s!%s@%s",
+                (int)strcspn(prefix, "!"), prefix,
+                irc_view_param(msg, 0),
+                irc_view_param(msg, 1));
+
+        if ((user = irc_user_get(sess, prefix)))
+            irc_user_set_prefix(sess, user, newprefix);
+
     } else if (msg->command == CMD_INVITE) {
         if (sess->cb.on_invite)
             sess->cb.on_invite(
                     sess->cb.arg,
-                    msg->prefix,
-                    msg->paramcount > 1
-                        ? msg->params[0]
-                        : msg->msg);
+                    prefix,
+                    (msg->paramcount > 1)
+                        ? irc_view_param(msg, 1)
+                        : trailing);
 
     } else if (msg->command == CMD_TOPIC) {
         struct irc_channel *target = NULL;
@@ -658,31 +1149,34 @@ int sess_handle_message(struct irc_session *sess, struct irc_message *msg)
 
         CHECK_ARGC(1, msg);
 
+        target = irc_channel_get(sess, irc_view_param(msg, 0));
+
         if (sess->cb.on_topic)
             sess->cb.on_topic(
                     sess->cb.arg,
-                    msg->prefix,
-                    msg->params[0],
-                    target->topic,
-                    msg->msg);
+                    prefix,
+                    irc_view_param(msg, 0),
+                    target ? target->topic : NULL,
+                    trailing);
 
         irc_mkmessage(&topic, CMD_TOPIC,
-                (const char *[]){ msg->params[0] }, 1, NULL);
+                (const char *[]){ irc_view_param(msg, 0) }, 1, NULL);
 
         sess_sendmsg(sess, &topic);
 
     } else if (msg->command == CMD_MODE) {
-        if ((msg->paramcount > 0) && (!irc_is_channel(msg->params[0]))) {
+        if ((msg->paramcount > 0)
+                && (!irc_is_channel(irc_view_param(msg, 0)))) {
             log_debug("ignoring user mode on self");
         } else {
             CHECK_ARGC(2, msg);
 
-            if (irc_user_cmp(msg->params[0], sess->nick))
+            if (!_sess_is_me(sess, irc_view_param(msg, 0)))
                 sess_handle_mode_change(sess,
-                    msg->prefix,
-                    msg->params[0],
-                    msg->params[1],
-                    msg->params, 2, msg->paramcount);
+                    prefix,
+                    irc_view_param(msg, 0),
+                    irc_view_param(msg, 1),
+                    msg, 2);
         }
     }
 
@@ -692,6 +1186,32 @@ exit_err:
     return 1;
 }
 
+/*
+ * Limit for cmd from a TARGMAX value ("PRIVMSG:4,NOTICE:,..."), where an
+ * empty limit means there is none. Commands not listed take a single target.
+ */
+static unsigned _sess_targmax(const char *val, const char *cmd)
+{
+    size_t cmdlen = strlen(cmd);
+    const char *p = val;
+
+    while (p && *p) {
+        if (!strncmp(p, cmd, cmdlen) && (p[cmdlen] == ':')) {
+            const char *n = p + cmdlen + 1;
+
+            if ((*n == ',') || (*n == '\0'))
+                return UINT_MAX;
+
+            return (atoi(n) > 1) ? (unsigned)atoi(n) : 1;
+        }
+
+        if ((p = strchr(p, ',')))
+            ++p;
+    }
+
+    return 1;
+}
+
 int sess_handle_isupport(struct irc_session *sess,
                          const char *sup,
                          const char *val)
@@ -719,11 +1239,92 @@ int sess_handle_isupport(struct irc_session *sess,
 
         } while (nptr != NULL);
     } else if (!strcmp(sup, "PREFIX") && (val != NULL)) {
+        /* (modes)symbols, both in the same order */
+        const char *sym = strchr(val, ')');
         size_t i;
-        size_t len = strlen(val);
 
-        for (i = 0; (i < (len / 2) - 1) && (i < IRC_CHANNEL_PREFIX_MAX); ++i)
-            sess->usermodes[i] = val[i + 1];
+        memset(sess->usermodes, 0, sizeof(sess->usermodes));
+        memset(sess->userprefixes, 0, sizeof(sess->userprefixes));
+        memset(sess->usermode_rank, 0, sizeof(sess->usermode_rank));
+
+        if ((val[0] != '(') || !sym) {
+            log_warn("Malformed PREFIX '%s'", val);
+            sym = NULL;
+        }
+
+        for (i = 0; sym && (val[i + 1] != ')') && sym[i + 1]
+                && (i < IRC_CHANNEL_PREFIX_MAX - 1); ++i) {
+            unsigned char mode = (unsigned char)val[i + 1];
+
+            sess->usermodes[i] = (char)mode;
+            sess->userprefixes[i] = sym[i + 1];
+
+            if (mode < IRC_MODE_SLOTS)
+                sess->usermode_rank[mode] = (unsigned char)(i + 1);
+        }
+    } else if (!strcmp(sup, "MAXLIST") && (val != NULL)) {
+        /* modes:limit,modes:limit,... */
+        const char *ptr = val;
+        size_t g;
+
+        memset(sess->maxlist, 0, sizeof(sess->maxlist));
+        memset(sess->maxlist_group, 0, sizeof(sess->maxlist_group));
+
+        for (g = 0; *ptr && (g < MAXLIST_MAX); ++g) {
+            const char *colon = strchr(ptr, ':');
+            char *end = NULL;
+            size_t n = 0;
+
+            if (!colon) {
+                log_warn("Malformed MAXLIST '%s'", val);
+                break;
+            }
+
+            for (; (ptr < colon) && (n < IRC_CHANNEL_PREFIX_MAX - 1); ++ptr) {
+                unsigned char mode = (unsigned char)*ptr;
+
+                sess->maxlist[g].modes[n++] = (char)mode;
+
+                if (mode < IRC_MODE_SLOTS)
+                    sess->maxlist_group[mode] = (unsigned char)(g + 1);
+            }
+
+            sess->maxlist[g].limit = (unsigned)strtoul(colon + 1, &end, 10);
+
+            ptr = (*end == ',') ? end + 1 : end;
+        }
+    } else if (!strcmp(sup, "CASEMAPPING") && (val != NULL)) {
+        enum irc_casemapping cm;
+        struct hashtable_iterator iter;
+        void *k;
+        void *v;
+
+        /*
+         * Announced right after registration, before there are any channels
+         * or users whose keys would have to be folded again. Servers do not
+         * change it later on, so stale keys are only worth a warning.
+         */
+        if (irc_casemap_lookup(val, &cm)) {
+            log_warn("Unknown CASEMAPPING '%s', keeping the previous one", val);
+        } else if (irc_casemap(cm) != sess->casemap) {
+            hashtable_iterator_init(&iter, sess->channels);
+
+            if (hashtable_iterator_next(&iter, &k, &v))
+                log_warn("CASEMAPPING changed to '%s' with channels joined, "
+                         "lookups may miss channels and users until they "
+                         "are joined again", val);
+
+            sess->casemap = irc_casemap(cm);
+        }
+
+    } else if (!strcmp(sup, "TARGMAX") && (val != NULL)) {
+        sess->targmax_privmsg = _sess_targmax(val, "PRIVMSG");
+        sess->targmax_notice = _sess_targmax(val, "NOTICE");
+    } else if (!strcmp(sup, "MAXTARGETS") && (val != NULL)
+            && !sess_capability_get(sess, "TARGMAX")) {
+        /* Older servers, TARGMAX takes precedence */
+        sess->targmax_privmsg = (atoi(val) > 1) ? (unsigned)atoi(val) : 1;
+        sess->targmax_notice = sess->targmax_privmsg;
     }
 
     return 0;
@@ -733,12 +1334,11 @@ int sess_handle_mode_change(struct irc_session *sess,
                             const char *prefix,
                             const char *chan,
                             const char *modestr,
-                            char args[][IRC_PARAM_MAX],
-                            size_t argstart,
-                            size_t argmax)
+                            const struct irc_message_view *msg,
+                            int argstart)
 {
     int set = 1; /* 1 = set, 0 = unset */
-    size_t i = argstart;
+    int i = argstart;
 
     struct irc_channel *t = NULL;
 
@@ -760,8 +1360,8 @@ int sess_handle_mode_change(struct irc_session *sess,
            ((strchr(sess->chanmodes[MODE_SETARG], *modestr) && set)) ||
             (strchr(sess->usermodes,              *modestr))) {
 
-            if (i < argmax) {
-                arg = args[i++];
+            if (i < msg->paramcount) {
+                arg = irc_view_param(msg, i++);
 
                 log_debug("%s: set mode %c%c with arg '%s'",
                     t->name, set ? '+' : '-', *modestr, arg);
@@ -777,7 +1377,7 @@ int sess_handle_mode_change(struct irc_session *sess,
         }
 
         if (set) {
-            irc_channel_set_mode(t, *modestr, arg);
+            irc_channel_set_mode(t, *modestr, arg, prefix, clock_time());
 
             if (sess->cb.on_mode_set)
                 sess->cb.on_mode_set(sess->cb.arg,
@@ -2,10 +2,15 @@
 #define SESSION_H
 
 #include "irc/irc.h"
+#include "irc/capture.h"
+#include "irc/outqueue.h"
+#include "irc/fairqueue.h"
 #include "util/log.h"
 #include "util/tokenbucket.h"
-
-#include <sys/select.h>
+#include "util/reactor.h"
+#include "util/intern.h"
+#include "util/linebuf.h"
+#include "util/slab.h"
 
 #include <time.h>
 #include <stdint.h>
@@ -15,7 +20,8 @@
 #define HOSTNAME_MAX 256
 #define SERVERPASS_MAX 256
 
-#define BUFFER_MAX (1024 * 8) /* 8 KiB */
+/* Groups of list modes sharing a limit in ISUPPORT MAXLIST */
+#define MAXLIST_MAX 8
 
 /* Time in seconds after which the connection is tested for aliveness */
 #define TIMEOUT 120
@@ -30,15 +36,52 @@
  * FLOODPROT_CAPACITY bytes can be sent in a single burst or multiple separate
  * bursts. Every second, FLOODPROT_RATE bytes are added back to that quota until
  * the maximum capacity is reached. If there are not enough bytes left in the
- * quota to send a message, it will be queued into a buffer with a maximum size
- * of (FLOODPROT_BUFFER - 1) messages. If the buffer is full, the message will
- * be discareded. If a message is smaller than FLOODPROT_MIN bytes, the number
- * of bytes removed from the quota will be FLOODPROT_MIN.
+ * quota to send a message, it will be queued into the buffer of its priority
+ * class (see below). If a message is smaller than FLOODPROT_MIN bytes, the
+ * number of bytes removed from the quota will be FLOODPROT_MIN.
+ *
+ * Messages are queued in their final wire format, see struct outmsg.
  */
 #define FLOODPROT_CAPACITY 512 /* the maximum burst message size in bytes */
 #define FLOODPROT_MIN      128
 #define FLOODPROT_RATE      64 /* how many bytes per second are refilled */
-#define FLOODPROT_BUFFER    32 /* how many irc messages can be buffered */
+
+/*
+ * Priority classes of outgoing messages, from highest to lowest.
+ *
+ * Queued messages of a higher class are always sent before those of a lower
+ * class, but all classes share the same quota. Each class buffers up to
+ * `capacity' messages. Once full, its drop policy decides whether a new
+ * message is discarded (SESS_DROP_NEWEST) or makes room by discarding the
+ * oldest queued one (SESS_DROP_OLDEST).
+ *
+ *  class                  capacity  drop policy
+ */
+#define SESS_PRIORITIES                                                       \
+    X(SESS_PRIO_PROTOCOL,        16, SESS_DROP_OLDEST) /* PONG, NICK, ... */ \
+    X(SESS_PRIO_MODERATION,      32, SESS_DROP_OLDEST) /* KICK, MODE */      \
+    X(SESS_PRIO_INTERACTIVE,     32, SESS_DROP_NEWEST) /* PRIVMSG, NOTICE */ \
+    X(SESS_PRIO_BULK,            64, SESS_DROP_NEWEST) /* explicit only */
+
+/*
+ * Separator between lines packed into one, if sess->pack_lines is set
+ */
+#define SESS_PACK_SEPARATOR " | "
+
+enum sess_drop_policy
+{
+    SESS_DROP_NEWEST,
+    SESS_DROP_OLDEST
+};
+
+enum sess_priority
+{
+#define X(prio, capacity, drop) prio,
+    SESS_PRIORITIES
+#undef X
+
+    SESS_PRIO_COUNT
+};
 
 struct irc_callbacks
 {
@@ -55,7 +98,7 @@ struct irc_callbacks
     /*
      * Read-only callbacks for IRC events.
      */
-    int (*on_event)(void *arg, const struct irc_message *m);
+    int (*on_event)(void *arg, const struct irc_message_view *m);
     int (*on_ping)(void *arg);
 
     int (*on_privmsg)(void *arg,
@@ -118,9 +161,33 @@ struct irc_callbacks
     int (*on_disconnect)(void *arg);
 };
 
+/*
+ * What became of messages that had to wait for flood protection
+ */
+struct sess_queue_stats
+{
+    unsigned long queued;
+    unsigned long merged;  /* into a message already waiting */
+    unsigned long dropped; /* to make room in a full buffer */
+    unsigned long expired; /* deadline passed while waiting */
+};
+
 struct irc_session
 {
     int fd;
+    int connected;
+
+    /*
+     * Event loop the session is attached to and the timers it owns there, on
+     * the reactor's timer wheel
+     */
+    struct reactor *reactor;
+    struct timer idle_timer;
+    struct timer timeout_timer;
+    struct timer flood_timer;
+
+    time_t lastidle;
+    time_t last_sign_of_life;
 
     time_t start;
     time_t session_start;
@@ -131,13 +198,40 @@ struct irc_session
 
     int kill;
 
-    char buffer[BUFFER_MAX];
-    size_t bufuse;
+    struct linebuf buffer;
+
+    /* If set, every line received is recorded here */
+    struct capture *capture;
+
+    /* Formatted messages waiting for flood protection, one queue per class */
+    struct fairqueue buffer_out[SESS_PRIO_COUNT];
+
+    /*
+     * While waiting, PRIVMSGs and NOTICEs with identical text are merged into
+     * one for up to targmax_* targets at once, as advertised by the server's
+     * TARGMAX. If pack_lines is set, consecutive lines to the same target are
+     * joined as well (off by default, as it changes what users see).
+     */
+    unsigned targmax_privmsg;
+    unsigned targmax_notice;
+    int pack_lines;
+
+    /*
+     * Time to live in milliseconds of messages sent by sess_sendmsg() and
+     * sess_sendmsg_prio(), 0 if they never expire. Messages still waiting
+     * once it has passed are discarded rather than sent late, without
+     * costing any quota.
+     */
+    unsigned send_ttl;
+
+    struct sess_queue_stats stats;
 
-    /* Circular output buffer */
-    struct irc_message buffer_out[FLOODPROT_BUFFER];
-    size_t buffer_out_start;
-    size_t buffer_out_end;
+    /*
+     * Messages that passed flood protection and wait for the socket to become
+     * writable. Everything in here is written with a single call per event
+     * loop iteration, if the socket allows.
+     */
+    struct outqueue wire;
 
     struct tokenbucket quota;
 
@@ -148,12 +242,47 @@ struct irc_session
     struct hashtable *channels;
     struct hashtable *capabilities;
 
+    /* Everyone sharing a channel with us, see irc/channel.h */
+    struct intern_map users;
+
+    /* Shared copies of channel names, user prefixes and the keys for both */
+    struct intern_table strings;
+
+    /* Where channel state is allocated from, see irc_channel_state_init() */
+    struct slab_cache channel_slab;
+    struct slab_cache user_slab;
+    struct slab_cache member_slab;
+    struct slab_cache mode_slab;
+    struct slab_cache entry_slab;
+
+    /*
+     * Fold table for ISUPPORT CASEMAPPING. Channels and users are keyed by
+     * their folded names.
+     */
+    const unsigned char *casemap;
+
     /*
      * A prefilled copy of the ISUPPORT CHANMODES modes, split up into groups,
-     * and the mode flags from PREFIX.
+     * and the mode flags from PREFIX with their symbols, highest rank first.
      */
     char chanmodes[4][IRC_PARAM_MAX];
     char usermodes[IRC_CHANNEL_PREFIX_MAX];
+    char userprefixes[IRC_CHANNEL_PREFIX_MAX];
+
+    /* Rank in usermodes plus one by mode character, 0 for any other mode */
+    unsigned char usermode_rank[IRC_MODE_SLOTS];
+
+    /*
+     * ISUPPORT MAXLIST, list modes in one group share their limit. The group
+     * of a mode plus one by mode character, 0 for no known limit.
+     */
+    struct irc_maxlist
+    {
+        char modes[IRC_CHANNEL_PREFIX_MAX];
+        unsigned limit;
+    } maxlist[MAXLIST_MAX];
+
+    unsigned char maxlist_group[IRC_MODE_SLOTS];
 
     struct irc_callbacks cb;
 };
@@ -175,12 +304,49 @@ const char *sess_capability_get(struct irc_session *sess, const char *cap);
 int         sess_capability_set(struct irc_session *sess, const char *cap,
                                                           const char *val);
 
-int sess_getln(struct irc_session *sess, char *linebuf, size_t linebufsiz);
+/*
+ * Fetch the next received line as a view into the receive buffer, see
+ * linebuf_getln(). The line stays valid until more data is received.
+ */
+int sess_getln(struct irc_session *sess, char **line, size_t *len);
+
+/*
+ * Send a message subject to flood protection. sess_sendmsg() picks the
+ * priority class by the message's command, see sess_msg_priority().
+ * sess_sendmsg_ttl() overrides sess->send_ttl for a single message.
+ * Messages are discarded (-1) unless the session is connected.
+ */
 int sess_sendmsg(struct irc_session *sess, const struct irc_message *msg);
+int sess_sendmsg_prio(struct irc_session *sess,
+                      const struct irc_message *msg,
+                      enum sess_priority prio);
+int sess_sendmsg_ttl(struct irc_session *sess,
+                     const struct irc_message *msg,
+                     unsigned ttl);
+
+enum sess_priority sess_msg_priority(const struct irc_message *msg);
 
-/* *actually* sends the message (bypassing the buffer) */
+/*
+ * Number of messages waiting for flood protection that go to target, over all
+ * priority classes. Messages other than PRIVMSG and NOTICE count towards "".
+ */
+size_t sess_queue_depth(const struct irc_session *sess, const char *target);
+
+/*
+ * *actually* sends the message (bypassing the buffer). The message is handed
+ * to the socket once it is writable, returns 1 on success.
+ */
 int sess_sendmsg_real(struct irc_session *sess, const struct irc_message *msg);
 
+/* Sends as many buffered messages as the flood protection allows */
+int sess_flush(struct irc_session *sess);
+
+/*
+ * Writes as much of the wire queue as the socket accepts without blocking.
+ * Returns < 0 on error.
+ */
+int sess_write(struct irc_session *sess);
+
 int sess_connect(struct irc_session *sess);
 int sess_disconnect(struct irc_session *sess);
 
@@ -189,13 +355,22 @@ int sess_disconnect(struct irc_session *sess);
  */
 int sess_main(struct irc_session *sess);
 
+/*
+ * Connect and register the session's socket and timers with an event loop,
+ * or unregister and disconnect it again. sess->connected is reset as soon as
+ * the connection is lost, after which the session should be detached.
+ */
+int  sess_attach(struct irc_session *sess, struct reactor *r);
+void sess_detach(struct irc_session *sess);
+
 int sess_login(struct irc_session *sess);
-int sess_handle_data(struct irc_session *sess, struct timeval *timeout);
+int sess_handle_data(struct irc_session *sess);
 
 /*
  * Logic
  */
-int sess_handle_message(struct irc_session *sess, struct irc_message *msg);
+int sess_handle_message(struct irc_session *sess,
+                        const struct irc_message_view *msg);
 int sess_handle_isupport(struct irc_session *sess,
                          const char *sup,
                          const char *val);
@@ -204,8 +379,7 @@ int sess_handle_mode_change(struct irc_session *sess,
                             const char *prefix,
                             const char *chan,
                             const char *modestr,
-                            char args[][IRC_PARAM_MAX],
-                            size_t argstart,
-                            size_t argmax);
+                            const struct irc_message_view *msg,
+                            int argstart);
 
 #endif /* defined SESSION_H */
@@ -8,6 +8,36 @@
 #include <string.h>
 
 
+/*
+ * Fold tables, one per case mapping, generated at compile time
+ */
+#define FOLD(c, last) \
+    (unsigned char)((((c) >= 'A') && ((c) <= (last))) ? (c) + 32 : (c))
+
+#define FOLD4(c, last)  FOLD((c), last),       FOLD((c) + 1, last),      \
+                        FOLD((c) + 2, last),   FOLD((c) + 3, last)
+#define FOLD16(c, last) FOLD4((c), last),      FOLD4((c) + 4, last),     \
+                        FOLD4((c) + 8, last),  FOLD4((c) + 12, last)
+#define FOLD64(c, last) FOLD16((c), last),     FOLD16((c) + 16, last),   \
+                        FOLD16((c) + 32, last), FOLD16((c) + 48, last)
+
+#define X(id, name, last) \
+    { FOLD64(0, last), FOLD64(64, last), FOLD64(128, last), FOLD64(192, last) },
+static const unsigned char _irc_casemaps[IRC_CASEMAPPING_COUNT][256] = {
+    IRC_CASEMAPPINGS
+};
+#undef X
+
+#define X(id, name, last) name,
+static const char *_irc_casemap_names[] = { IRC_CASEMAPPINGS };
+#undef X
+
+#undef FOLD64
+#undef FOLD16
+#undef FOLD4
+#undef FOLD
+
+
 /*
  * Split a prefix
  */
@@ -197,6 +227,37 @@ int irc_strwcmp(const char *str, const char *pat)
     return !(!*str && !*pat);
 }
 
+const unsigned char *irc_casemap(enum irc_casemapping cm)
+{
+    return _irc_casemaps[cm];
+}
+
+int irc_casemap_lookup(const char *name, enum irc_casemapping *cm)
+{
+    for (int i = 0; i < IRC_CASEMAPPING_COUNT; ++i)
+        if (!strcmp(name, _irc_casemap_names[i])) {
+            *cm = (enum irc_casemapping)i;
+            return 0;
+        }
+
+    return 1;
+}
+
+size_t irc_casefold(const unsigned char *map,
+                    char *dst,
+                    const char *src,
+                    size_t n)
+{
+    size_t i = 0;
+
+    for (; src[i] && (i < n - 1); ++i)
+        dst[i] = (char)map[(unsigned char)src[i]];
+
+    dst[i] = '\0';
+
+    return i;
+}
+
 const struct irc_prefix_parts *irc_get_prefix_parts(const char *prefix)
 {
     static struct irc_prefix_parts parts;
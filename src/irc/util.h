@@ -8,6 +8,25 @@
 /* Simple macro that wraps a string literal between two \1 chars for CTCP. */
 #define MKCTCP(lit) "\x01" lit "\x01"
 
+/*
+ * Case mappings a server can announce with ISUPPORT CASEMAPPING, and the last
+ * character of the uppercase range that folds onto its lowercase counterpart
+ * 32 places further up. rfc1459 also treats []\\^ as the uppercase of {}|~,
+ * strict-rfc1459 leaves out ^.
+ */
+#define IRC_CASEMAPPINGS                        \
+    X(ASCII,          "ascii",          'Z')    \
+    X(RFC1459,        "rfc1459",        '^')    \
+    X(STRICT_RFC1459, "strict-rfc1459", ']')
+
+#define X(id, name, last) IRC_CASEMAPPING_ ## id,
+enum irc_casemapping
+{
+    IRC_CASEMAPPINGS
+    IRC_CASEMAPPING_COUNT
+};
+#undef X
+
 struct irc_prefix_parts
 {
     char nick[IRC_NICK_MAX];
@@ -60,6 +79,25 @@ void irc_mkctcp_response(struct irc_message *dest,
                          const char *ctcp,
                          const char *msgfmt, ...);
 
+/*
+ * Case folding. irc_casemap() returns the 256 entry table that maps every
+ * character to its folded form, irc_casemap_lookup() finds a mapping by name
+ * and returns nonzero if it is unknown.
+ *
+ * Names are folded once when they are stored, lookups fold the name looked
+ * for and compare bytes from there on.
+ */
+const unsigned char *irc_casemap(enum irc_casemapping cm);
+int irc_casemap_lookup(const char *name, enum irc_casemapping *cm);
+
+/*
+ * Fold src into dst, which holds n bytes, and return the length of the result
+ */
+size_t irc_casefold(const unsigned char *map,
+                    char *dst,
+                    const char *src,
+                    size_t n);
+
 /*
  * Test commands
  */
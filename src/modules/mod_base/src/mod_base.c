@@ -223,11 +223,11 @@ int base_handle_command(
     } else if (!strcmp(cmd, "version")) {
         respond(SESSION, target, irc_get_nick(prefix), versionstr);
     } else if (!strcmp(cmd, "rek")) {
-        struct irc_user *usr = irc_channel_get_user(
-                                   irc_channel_get(SESSION, target), args);
+        struct irc_member *usr = irc_channel_get_user(
+                                     irc_channel_get(SESSION, target), args);
 
         if (usr) {
-            respond(SESSION, target, irc_get_nick(usr->prefix),
+            respond(SESSION, target, irc_get_nick(usr->user->prefix),
                 reks[rand() % NREKS]);
         } else {
             respond(SESSION, target, irc_get_nick(prefix),
@@ -51,7 +51,7 @@ int mod_lua_dispatch(enum mod_event_type type, const char *argtypes, ...)
 
             case 'm':
                 lua_util_push_irc_message(L,
-                        va_arg(args, struct irc_message *));
+                        va_arg(args, const struct irc_message_view *));
                 nargs++;
                 break;
 
@@ -90,23 +90,24 @@ int mod_lua_dispatch(enum mod_event_type type, const char *argtypes, ...)
 /*
  * Pushers
  */
-int lua_util_push_irc_message(lua_State *L, const struct irc_message *msg)
+int lua_util_push_irc_message(lua_State *L,
+                              const struct irc_message_view *msg)
 {
     int tab = (lua_newtable(L), lua_gettop(L));
     int argtab;
 
-    lua_pushstring(L, msg->prefix);
+    lua_pushstring(L, irc_view_prefix(msg));
     lua_setfield(L, tab, "prefix");
 
-    lua_pushstring(L, msg->command);
+    lua_pushstring(L, irc_view_command(msg));
     lua_setfield(L, tab, "command");
 
-    lua_pushstring(L, msg->msg);
+    lua_pushstring(L, irc_view_msg(msg));
     lua_setfield(L, tab, "message");
 
     argtab = (lua_newtable(L), lua_gettop(L));
     for (int i = 0; i < msg->paramcount; ++i) {
-        lua_pushstring(L, msg->params[i]);
+        lua_pushstring(L, irc_view_param(msg, i));
         lua_rawseti(L, argtab, i + 1);
     }
 
@@ -139,40 +140,36 @@ int lua_util_push_irc_channel_meta(lua_State *L, const struct irc_channel *ch)
 
 int lua_util_push_irc_channel_modes(lua_State *L, const struct irc_channel *ch)
 {
-    struct list *ptr = NULL;
     int  mtab = (lua_newtable(L), lua_gettop(L));
 
-    LIST_FOREACH(ch->modes, ptr) {
-        struct irc_mode *mode = list_data(ptr, struct irc_mode *);
+    for (int i = 1; i < IRC_MODE_SLOTS; ++i) {
+        const struct irc_mode *mode = NULL;
 
-        char modestr[2] = { mode->mode, '\0' };
+        char modestr[2] = { (char)i, '\0' };
 
-        lua_getfield(L, mtab, modestr);
-        if (lua_isnil(L, -1)) {
-            /* nil, set modes[m] = arg */
-            lua_pop(L, 1); /* discard */
+        if (!irc_channel_has_mode(ch, (char)i))
+            continue;
 
-            lua_pushstring(L, mode->arg);
-            lua_setfield(L, mtab, modestr);
-        } else if (lua_isstring(L, -1)) {
-            /* string, set modes[m] = { modes[m], arg } */
-            int matab = (lua_newtable(L), lua_gettop(L));
+        if (!(mode = irc_channel_get_mode(ch, (char)i))) {
+            /* Simple mode, modes[m] = "" */
+            lua_pushstring(L, "");
+        } else if (mode->type == IRC_MODE_LIST) {
+            /* List mode, modes[m] = { arg1, arg2, ... } in order set */
+            const struct irc_mode_entry *e = NULL;
+            int n = 0;
 
-            /* Push old value to modes[m][1] */
-            lua_rawseti(L, matab, 1);
+            lua_newtable(L);
 
-            /* Push new value to modes[m][2] */
-            lua_pushstring(L, mode->arg);
-            lua_rawseti(L, matab, 2);
-
-            lua_setfield(L, mtab, modestr);
-        } else if (lua_istable(L, -1)) {
-            /* table, append */
-            int len = lua_rawlen(L, -1);
-
-            lua_pushstring(L, mode->arg);
-            lua_rawseti(L, -2, len);
+            for (e = mode->value.list.first; e; e = e->next) {
+                lua_pushstring(L, e->mask);
+                lua_rawseti(L, -2, ++n);
+            }
+        } else {
+            /* Mode with argument, modes[m] = arg */
+            lua_pushstring(L, mode->value.arg);
         }
+
+        lua_setfield(L, mtab, modestr);
     }
 
     return 1;
@@ -180,14 +177,21 @@ int lua_util_push_irc_channel_modes(lua_State *L, const struct irc_channel *ch)
 
 int lua_util_push_irc_channel_users(lua_State *L, const struct irc_channel *ch)
 {
-    struct list *ptr = NULL;
+    struct intern_map_iterator iter;
+    struct intern_node *n = NULL;
+
     int ulist = (lua_newtable(L), lua_gettop(L));
 
-    LIST_FOREACH(ch->users, ptr) {
-        const struct irc_user *user = list_data(ptr, const struct irc_user *);
+    intern_map_iterator_init(&iter, &ch->users);
+    while ((n = intern_map_iterator_next(&iter))) {
+        const struct irc_member *member =
+            intern_map_entry(n, struct irc_member, node);
+        char modes[IRC_FLAGS_MAX];
+
+        irc_channel_user_modes(member, modes);
 
-        lua_pushstring(L, user->modes);
-        lua_setfield(L, ulist, user->prefix);
+        lua_pushstring(L, modes);
+        lua_setfield(L, ulist, member->user->prefix);
     }
 
     return 1;
@@ -13,7 +13,8 @@ int mod_lua_dispatch(enum mod_event_type type, const char *argtypes, ...);
 /*
  * Pushers
  */
-int lua_util_push_irc_message(lua_State *L, const struct irc_message *msg);
+int lua_util_push_irc_message(lua_State *L,
+                              const struct irc_message_view *msg);
 
 int lua_util_push_irc_channel_meta(lua_State *L, const struct irc_channel *ch);
 int lua_util_push_irc_channel_modes(lua_State *L, const struct irc_channel *ch);
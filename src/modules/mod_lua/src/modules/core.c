@@ -1,12 +1,15 @@
 #include <string.h>
+#include <stdint.h>
 
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
 
+#include "bot/bot.h"
 #include "irc/irc.h"
 #include "irc/session.h"
 #include "irc/util.h"
+#include "modules/module.h"
 #include "util/list.h"
 
 #include "mod_lua.h"
@@ -14,11 +17,22 @@
 
 #include "modules/core.h"
 
+/* Only while an event or a timer added during one is handled */
+#define CHECK_SESSION(L)                                           \
+    if (!SESSION)                                                  \
+        return luaL_error((L), "no current session");
+
 
 int mod_lua_register_core()
 {
     const struct luaL_Reg core_functions[] = {
         { "sendmsg", mod_lua_core_sendmsg },
+        { "set_ttl", mod_lua_core_set_ttl },
+        { "get_queue_depth", mod_lua_core_get_queue_depth },
+        { "get_queue_stats", mod_lua_core_get_queue_stats },
+        { "schedule", mod_lua_core_schedule },
+        { "reschedule", mod_lua_core_reschedule },
+        { "cancel", mod_lua_core_cancel },
         { "get_identity", mod_lua_core_get_identity },
         { "get_channels", mod_lua_core_get_channels },
         { "get_channel_meta", mod_lua_core_get_channel_meta },
@@ -44,16 +58,154 @@ int mod_lua_core_sendmsg(lua_State *L)
 {
     struct irc_message msg;
 
+    /* Optional time to live in milliseconds, overriding the default */
+    int has_ttl = !lua_isnoneornil(L, 2);
+    lua_Integer ttl = has_ttl ? luaL_checkinteger(L, 2) : 0;
+
+    luaL_argcheck(L, ttl >= 0, 2, "time to live can not be negative");
+
+    /* Stack: message table */
+    lua_settop(L, 1);
+
     if (lua_util_check_irc_message(L, &msg))
         return luaL_error(L, "incomplete or invalid irc message table");
 
-    bot_send_message(BOTREF, &msg);
+    if (has_ttl)
+        bot_send_message_ttl(BOTREF, &msg, (unsigned)ttl);
+    else
+        bot_send_message(BOTREF, &msg);
 
     return 0;
 }
 
+int mod_lua_core_set_ttl(lua_State *L)
+{
+    lua_Integer ttl = luaL_checkinteger(L, 1);
+
+    luaL_argcheck(L, ttl >= 0, 1, "time to live can not be negative");
+
+    /*
+     * Only for the rest of the event or timer being handled, so one script
+     * can not change it for all others. Returns the previous one.
+     */
+    lua_pushinteger(L, SESSION ? SESSION->send_ttl : 0);
+
+    if (SESSION)
+        SESSION->send_ttl = (unsigned)ttl;
+
+    return 1;
+}
+
+int mod_lua_core_get_queue_depth(lua_State *L)
+{
+    CHECK_SESSION(L)
+
+    /* Messages waiting for flood protection, for target or everything else */
+    lua_pushinteger(L, (lua_Integer)sess_queue_depth(SESSION,
+                luaL_optstring(L, 1, "")));
+
+    return 1;
+}
+
+int mod_lua_core_get_queue_stats(lua_State *L)
+{
+    CHECK_SESSION(L)
+
+    const struct sess_queue_stats *st = &SESSION->stats;
+    int stab = (lua_newtable(L), lua_gettop(L));
+
+    lua_pushinteger(L, (lua_Integer)st->queued);
+    lua_setfield(L, stab, "queued");
+
+    lua_pushinteger(L, (lua_Integer)st->merged);
+    lua_setfield(L, stab, "merged");
+
+    lua_pushinteger(L, (lua_Integer)st->dropped);
+    lua_setfield(L, stab, "dropped");
+
+    lua_pushinteger(L, (lua_Integer)st->expired);
+    lua_setfield(L, stab, "expired");
+
+    return 1;
+}
+
+/*
+ * Timers keep a reference to their function in the registry, the reference
+ * is what gets passed to the callback.
+ */
+static void _mod_lua_core_timer_fire(struct bot *bot, void *arg)
+{
+    lua_State *L = mod_lua_state.L;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, (int)(intptr_t)arg);
+
+    if (lua_pcall(L, 0, 0, 0) != 0) {
+        log_error_n("mod_lua", "Error calling timer function: %s",
+                lua_tostring(L, -1));
+
+        lua_pop(L, 1);
+    }
+}
+
+static void _mod_lua_core_timer_free(void *arg)
+{
+    luaL_unref(mod_lua_state.L, LUA_REGISTRYINDEX, (int)(intptr_t)arg);
+}
+
+int mod_lua_core_schedule(lua_State *L)
+{
+    lua_Integer ms = luaL_checkinteger(L, 1);
+    lua_Integer interval = luaL_optinteger(L, 3, 0);
+    int ref;
+    int id;
+
+    luaL_argcheck(L, ms >= 0, 1, "delay can not be negative");
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    luaL_argcheck(L, interval >= 0, 3, "interval can not be negative");
+
+    /* Stack: function */
+    lua_pushvalue(L, 2);
+    ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    id = bot_timer_add(BOTREF, &mod_info,
+            (unsigned long)ms, (unsigned long)interval,
+            _mod_lua_core_timer_fire, (void *)(intptr_t)ref,
+            _mod_lua_core_timer_free);
+
+    if (id < 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        return luaL_error(L, "unable to schedule timer");
+    }
+
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+int mod_lua_core_reschedule(lua_State *L)
+{
+    lua_Integer id = luaL_checkinteger(L, 1);
+    lua_Integer ms = luaL_checkinteger(L, 2);
+
+    luaL_argcheck(L, ms >= 0, 2, "delay can not be negative");
+
+    lua_pushboolean(L, !bot_timer_reschedule(BOTREF, (int)id,
+                (unsigned long)ms));
+
+    return 1;
+}
+
+int mod_lua_core_cancel(lua_State *L)
+{
+    lua_Integer id = luaL_checkinteger(L, 1);
+
+    lua_pushboolean(L, !bot_timer_cancel(BOTREF, (int)id));
+    return 1;
+}
+
 int mod_lua_core_get_identity(lua_State *L)
 {
+    CHECK_SESSION(L)
+
     const char *kind = lua_tostring(L, 1);
     int itab = (lua_newtable(L), lua_gettop(L));
 
@@ -85,6 +237,8 @@ int mod_lua_core_get_identity(lua_State *L)
 
 int mod_lua_core_get_channels(lua_State *L)
 {
+    CHECK_SESSION(L)
+
     struct list *channels = BOTREF->sess->channels;
     struct list *ptr = NULL;
 
@@ -103,6 +257,8 @@ int mod_lua_core_get_channels(lua_State *L)
 
 int mod_lua_core_get_channel_meta(lua_State *L)
 {
+    CHECK_SESSION(L)
+
     const char *chan = luaL_checkstring(L, 1);
 
     struct list *channels = BOTREF->sess->channels;
@@ -116,6 +272,8 @@ int mod_lua_core_get_channel_meta(lua_State *L)
 
 int mod_lua_core_get_channel_modes(lua_State *L)
 {
+    CHECK_SESSION(L)
+
     const char *chan = luaL_checkstring(L, 1);
 
     struct list *channels = BOTREF->sess->channels;
@@ -129,6 +287,8 @@ int mod_lua_core_get_channel_modes(lua_State *L)
 
 int mod_lua_core_get_channel_users(lua_State *L)
 {
+    CHECK_SESSION(L)
+
     const char *chan = luaL_checkstring(L, 1);
 
     struct list *channels = BOTREF->sess->channels;
@@ -142,6 +302,8 @@ int mod_lua_core_get_channel_users(lua_State *L)
 
 int mod_lua_core_get_server_caps(lua_State *L)
 {
+    CHECK_SESSION(L)
+
     struct list *caps = BOTREF->sess->capabilities;
 
     return lua_util_push_irc_caps(L, caps);
@@ -7,6 +7,13 @@
 int mod_lua_register_core();
 
 int mod_lua_core_sendmsg(lua_State *L);
+int mod_lua_core_set_ttl(lua_State *L);
+int mod_lua_core_get_queue_depth(lua_State *L);
+int mod_lua_core_get_queue_stats(lua_State *L);
+
+int mod_lua_core_schedule(lua_State *L);
+int mod_lua_core_reschedule(lua_State *L);
+int mod_lua_core_cancel(lua_State *L);
 int mod_lua_core_get_identity(lua_State *L);
 
 int mod_lua_core_get_channels(lua_State *L);
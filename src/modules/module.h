@@ -70,9 +70,13 @@ enum mod_event_type
 static const char *_mod_event_name[] = { EVENTS };
 #undef X
 
+/*
+ * Only valid for the duration of the event, use irc_message_from_view() to
+ * keep a copy.
+ */
 struct mod_event_raw
 {
-    const struct irc_message *msg;
+    const struct irc_message_view *msg;
 };
 
 /* privmsg, notice and action */
@@ -163,7 +167,10 @@ struct mod_event_modes
     const char *modes;
 };
 
-/* aux. event, called every second (default) */
+/*
+ * aux. event, called every second (default). Modules waiting for something to
+ * happen at a certain time should rather use bot_timer_add() than poll.
+ */
 struct mod_event_idle
 {
     time_t last;
@@ -173,6 +180,9 @@ struct mod_event
 {
     enum mod_event_type type;
 
+    /* Session (network) the event originates from */
+    struct irc_session *session;
+
     union mod_event_event
     {
         struct mod_event_raw            raw;
@@ -215,6 +225,13 @@ struct mod
      */
     uint64_t hooks;
 
+    /*
+     * Default time to live in milliseconds of messages sent while handling an
+     * event. Replies still held back by flood protection after that long are
+     * dropped instead of arriving late. 0 means they never expire.
+     */
+    unsigned ttl;
+
     /*
      * Set via calling code, a reference to the main host
      * structure.
@@ -224,7 +241,7 @@ struct mod
 
 extern struct mod mod_info;
 
-/* For being lazy */
+/* For being lazy. SESSION is the session of the event currently handled. */
 #define BOTREF (mod_info.bot)
 #define SESSION (BOTREF->sess)
 
@@ -0,0 +1,993 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * fakeircd - a stand-in IRC server for load and latency testing.
+ *
+ * Listens on loopback and serves a single client at a time, normally the bot.
+ * It speaks just enough of the protocol to get through registration (001-005
+ * and the end of the MOTD) and then joins the client to a number of channels
+ * populated by synthetic users, answering WHO and MODE queries for them.
+ *
+ * Once registered, the client is fed a steady stream of messages from those
+ * users, mixed with joins, parts, quits and nick changes. Every so often a
+ * probe user asks the client to "ping", and the time until its "pong" arrives
+ * is the end-to-end command latency, which includes the client's flood
+ * protection. At the end, or on ^C, latency percentiles and the number of lines
+ * the client managed to take per second are printed.
+ *
+ * The outgoing buffer is bounded, so a client that cannot keep up slows the
+ * load down rather than letting it pile up, and lines/s is what it sustained.
+ */
+#include "irc/irc.h"
+#include "util/clock.h"
+#include "util/linebuf.h"
+#include "util/log.h"
+#include "util/reactor.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#define FAKE_SERVER "fake.irc"
+
+#define FAKE_TICK_MS    10  /* load generation granularity */
+#define FAKE_REPORT_MS  1000
+
+#define FAKE_OUTBUF_MAX (64 * 1024) /* stop generating beyond this */
+#define FAKE_NAMES_MAX  400         /* bytes of nicks per RPL_NAMREPLY */
+
+#define FAKE_NICK_MAX   32
+#define FAKE_PROBE_MAX  4096        /* probes that can be in flight */
+
+struct fake_user
+{
+    char nick[FAKE_NICK_MAX];
+    unsigned renames;
+    int present;
+};
+
+struct fake_channel
+{
+    char name[32];
+    struct fake_user *users;
+};
+
+struct fake_probe
+{
+    unsigned long seq;
+    uint64_t sent; /* 0 = answered or never sent */
+};
+
+struct fake_client
+{
+    int fd;
+
+    struct linebuf in;
+
+    char *out;
+    size_t outlen;
+    size_t outsize;
+
+    char nick[FAKE_NICK_MAX];
+    int has_user;
+    int registered;
+};
+
+struct fakeircd
+{
+    struct reactor reactor;
+    int listenfd;
+
+    /* Only one client at a time, fd < 0 if there is none */
+    struct fake_client client;
+
+    /* Options */
+    unsigned nchannels;
+    unsigned nusers;
+    unsigned churn;     /* percentage of events that are not messages */
+    unsigned long rate; /* lines/s, 0 = as fast as the client reads */
+    unsigned long probe_ms;
+    unsigned long duration_ms;
+
+    struct fake_channel *channels;
+
+    struct timer load_timer;
+    struct timer probe_timer;
+    struct timer report_timer;
+    struct timer stop_timer;
+
+    /* Load */
+    uint64_t load_start;
+    unsigned long generated;
+    unsigned long last_generated;
+    unsigned long received;
+
+    /* Latency */
+    struct fake_probe probes[FAKE_PROBE_MAX];
+    unsigned long probes_sent;
+    unsigned long probes_answered;
+
+    uint64_t *latencies;
+    size_t nlatencies;
+    size_t latencies_size;
+
+    volatile sig_atomic_t done;
+};
+
+static struct fakeircd *_fake_instance = NULL;
+
+
+static void _fake_sigint(int sig)
+{
+    if (_fake_instance)
+        _fake_instance->done = 1;
+}
+
+static void _fake_send(struct fake_client *c, const char *fmt, ...)
+{
+    char line[IRC_MESSAGE_MAX];
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(line, sizeof(line) - 2, fmt, args);
+    va_end(args);
+
+    if (n < 0)
+        return;
+
+    if ((size_t)n > sizeof(line) - 3)
+        n = (int)sizeof(line) - 3;
+
+    line[n++] = '\r';
+    line[n++] = '\n';
+
+    /* Replies and probes go out regardless of FAKE_OUTBUF_MAX */
+    if (c->outlen + (size_t)n > c->outsize) {
+        size_t size = c->outsize * 2;
+        char *tmp = realloc(c->out, size);
+
+        if (!tmp) {
+            log_perror("realloc()", LOG_ERROR);
+            return;
+        }
+
+        c->out = tmp;
+        c->outsize = size;
+    }
+
+    memcpy(c->out + c->outlen, line, (size_t)n);
+    c->outlen += (size_t)n;
+}
+
+static int _fake_room(const struct fake_client *c)
+{
+    return c->outlen < FAKE_OUTBUF_MAX;
+}
+
+static void _fake_disconnect(struct fakeircd *s);
+
+static void _fake_flush(struct fakeircd *s)
+{
+    struct fake_client *c = &s->client;
+
+    if (c->fd < 0)
+        return;
+
+    while (c->outlen > 0) {
+        ssize_t n = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+
+            if (errno == EINTR)
+                continue;
+
+            log_perror("send()", LOG_ERROR);
+
+            _fake_disconnect(s);
+            return;
+        }
+
+        memmove(c->out, c->out + n, c->outlen - (size_t)n);
+        c->outlen -= (size_t)n;
+    }
+
+    reactor_modify(&s->reactor, c->fd,
+            REACTOR_READ | (c->outlen ? REACTOR_WRITE : 0));
+}
+
+/*
+ * Synthetic users
+ */
+static void _fake_user_name(struct fakeircd *s,
+                            unsigned chan,
+                            unsigned idx)
+{
+    struct fake_user *u = &s->channels[chan].users[idx];
+
+    if (u->renames)
+        snprintf(u->nick, sizeof(u->nick), "c%uu%un%u", chan, idx, u->renames);
+    else
+        snprintf(u->nick, sizeof(u->nick), "c%uu%u", chan, idx);
+}
+
+#define FAKE_USER_FMT "%s!user%u@u%u.c%u." FAKE_SERVER
+#define FAKE_USER_ARGS(u, chan, idx) (u)->nick, (idx), (idx), (chan)
+
+static void _fake_names(struct fakeircd *s,
+                        struct fake_client *c,
+                        unsigned chan)
+{
+    struct fake_channel *ch = &s->channels[chan];
+
+    char names[FAKE_NAMES_MAX + FAKE_NICK_MAX + 2] = {0};
+    size_t len = 0;
+
+    len = (size_t)sprintf(names, "@%s", c->nick);
+
+    for (unsigned i = 0; i < s->nusers; ++i) {
+        struct fake_user *u = &ch->users[i];
+
+        if (!u->present)
+            continue;
+
+        if (len > FAKE_NAMES_MAX) {
+            _fake_send(c, ":" FAKE_SERVER " 353 %s = %s :%s",
+                    c->nick, ch->name, names);
+
+            len = 0;
+        }
+
+        /* Every tenth user is voiced */
+        len += (size_t)sprintf(names + len, "%s%s%s",
+                len ? " " : "", (i % 10) ? "" : "+", u->nick);
+    }
+
+    if (len)
+        _fake_send(c, ":" FAKE_SERVER " 353 %s = %s :%s",
+                c->nick, ch->name, names);
+
+    _fake_send(c, ":" FAKE_SERVER " 366 %s %s :End of /NAMES list.",
+            c->nick, ch->name);
+}
+
+static void _fake_who(struct fakeircd *s, struct fake_client *c, unsigned chan)
+{
+    struct fake_channel *ch = &s->channels[chan];
+
+    _fake_send(c, ":" FAKE_SERVER " 352 %s %s bot localhost " FAKE_SERVER
+            " %s H@ :0 %s", c->nick, ch->name, c->nick, c->nick);
+
+    for (unsigned i = 0; i < s->nusers; ++i) {
+        struct fake_user *u = &ch->users[i];
+
+        if (u->present)
+            _fake_send(c, ":" FAKE_SERVER " 352 %s %s user%u u%u.c%u."
+                    FAKE_SERVER " " FAKE_SERVER " %s H%s :0 Synthetic user",
+                    c->nick, ch->name, i, i, chan, u->nick,
+                    (i % 10) ? "" : "+");
+    }
+
+    _fake_send(c, ":" FAKE_SERVER " 315 %s %s :End of /WHO list.",
+            c->nick, ch->name);
+}
+
+static int _fake_find_channel(struct fakeircd *s, const char *name)
+{
+    for (unsigned i = 0; i < s->nchannels; ++i)
+        if (!strcmp(s->channels[i].name, name))
+            return (int)i;
+
+    return -1;
+}
+
+/*
+ * One line of load: a message, or a join for users that are not around
+ */
+static void _fake_event(struct fakeircd *s, struct fake_client *c)
+{
+    unsigned chan = (unsigned)rand() % s->nchannels;
+    unsigned idx = (unsigned)rand() % s->nusers;
+    unsigned roll = (unsigned)rand() % 100;
+
+    struct fake_channel *ch = &s->channels[chan];
+    struct fake_user *u = &ch->users[idx];
+
+    if (!u->present) {
+        u->present = 1;
+
+        _fake_send(c, ":" FAKE_USER_FMT " JOIN %s",
+                FAKE_USER_ARGS(u, chan, idx), ch->name);
+    } else if (roll >= s->churn) {
+        _fake_send(c, ":" FAKE_USER_FMT " PRIVMSG %s :message %lu from %s, "
+                "nothing to see here", FAKE_USER_ARGS(u, chan, idx), ch->name,
+                s->generated, u->nick);
+    } else {
+        switch (roll % 3) {
+            case 0:
+                u->present = 0;
+
+                _fake_send(c, ":" FAKE_USER_FMT " PART %s :leaving",
+                        FAKE_USER_ARGS(u, chan, idx), ch->name);
+                break;
+
+            case 1:
+                /* Users are only ever on their own channel */
+                u->present = 0;
+
+                _fake_send(c, ":" FAKE_USER_FMT " QUIT :Quit: bye",
+                        FAKE_USER_ARGS(u, chan, idx));
+                break;
+
+            case 2: {
+                char old[FAKE_NICK_MAX];
+
+                strcpy(old, u->nick);
+
+                u->renames++;
+                _fake_user_name(s, chan, idx);
+
+                _fake_send(c, ":%s!user%u@u%u.c%u." FAKE_SERVER " NICK :%s",
+                        old, idx, idx, chan, u->nick);
+                break;
+            }
+        }
+    }
+
+    s->generated++;
+}
+
+static void _fake_generate(struct fakeircd *s)
+{
+    struct fake_client *c = &s->client;
+    unsigned long target = ULONG_MAX;
+
+    if ((c->fd < 0) || !c->registered)
+        return;
+
+    if (s->rate) {
+        uint64_t elapsed = clock_mono_ns() - s->load_start;
+
+        target = (unsigned long)(elapsed * s->rate / UINT64_C(1000000000));
+    }
+
+    while ((s->generated < target) && _fake_room(c))
+        _fake_event(s, c);
+
+    _fake_flush(s);
+}
+
+static void _fake_on_load(struct timer *t, void *arg)
+{
+    struct fakeircd *s = arg;
+
+    _fake_generate(s);
+
+    if (s->client.fd >= 0)
+        reactor_schedule(&s->reactor, &s->load_timer, FAKE_TICK_MS);
+}
+
+/*
+ * Latency probes, each from a fresh nick so the reply says which one it was
+ */
+static void _fake_on_probe(struct timer *t, void *arg)
+{
+    struct fakeircd *s = arg;
+    struct fake_client *c = &s->client;
+
+    if ((c->fd < 0) || !c->registered)
+        return;
+
+    {
+        unsigned long seq = ++s->probes_sent;
+        struct fake_probe *p = &s->probes[seq % FAKE_PROBE_MAX];
+
+        p->seq = seq;
+        p->sent = clock_system_ns();
+
+        _fake_send(c, ":probe%lu!probe@probe." FAKE_SERVER " PRIVMSG %s :%s: ping",
+                seq, s->channels[seq % s->nchannels].name, c->nick);
+
+        _fake_flush(s);
+    }
+
+    reactor_schedule(&s->reactor, &s->probe_timer, s->probe_ms);
+}
+
+static void _fake_probe_reply(struct fakeircd *s, const char *text)
+{
+    struct fake_probe *p = NULL;
+    unsigned long seq;
+    char *end = NULL;
+
+    if (strncmp(text, "probe", 5))
+        return;
+
+    seq = strtoul(text + 5, &end, 10);
+
+    if ((end == text + 5) || (*end != ':'))
+        return;
+
+    p = &s->probes[seq % FAKE_PROBE_MAX];
+
+    /* Answered twice, or so late that the slot has been reused */
+    if ((p->seq != seq) || !p->sent)
+        return;
+
+    if (s->nlatencies == s->latencies_size) {
+        size_t size = s->latencies_size ? s->latencies_size * 2 : 1024;
+        uint64_t *tmp = realloc(s->latencies, size * sizeof(*tmp));
+
+        if (!tmp) {
+            log_perror("realloc()", LOG_ERROR);
+            return;
+        }
+
+        s->latencies = tmp;
+        s->latencies_size = size;
+    }
+
+    s->latencies[s->nlatencies++] = clock_system_ns() - p->sent;
+    s->probes_answered++;
+
+    p->sent = 0;
+}
+
+/*
+ * Client handling
+ */
+static void _fake_register(struct fakeircd *s, struct fake_client *c)
+{
+    c->registered = 1;
+
+    _fake_send(c, ":" FAKE_SERVER " 001 %s :Welcome to the fake network %s",
+            c->nick, c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 002 %s :Your host is " FAKE_SERVER,
+            c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 003 %s :This server was created just now",
+            c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 004 %s " FAKE_SERVER " fakeircd-1 iow "
+            "beIklmnopstv", c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 005 %s CHANTYPES=# PREFIX=(ov)@+ "
+            "CHANMODES=beI,k,l,imnpst MODES=4 NICKLEN=%d CASEMAPPING=rfc1459 "
+            "NETWORK=Fake :are supported by this server",
+            c->nick, FAKE_NICK_MAX - 1);
+    _fake_send(c, ":" FAKE_SERVER " 005 %s TARGMAX=PRIVMSG:4,NOTICE:4,JOIN: "
+            "MAXLIST=beI:100 :are supported by this server", c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 375 %s :- " FAKE_SERVER
+            " Message of the day -", c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 372 %s :- Nothing to see here", c->nick);
+    _fake_send(c, ":" FAKE_SERVER " 376 %s :End of /MOTD command.", c->nick);
+
+    /* Straight into every channel */
+    for (unsigned i = 0; i < s->nchannels; ++i) {
+        _fake_send(c, ":%s!bot@localhost JOIN %s",
+                c->nick, s->channels[i].name);
+
+        _fake_names(s, c, i);
+    }
+
+    _fake_flush(s);
+
+    log_info("%s registered, starting load", c->nick);
+
+    s->load_start = clock_mono_ns();
+    s->generated = 0;
+    s->last_generated = 0;
+
+    reactor_schedule(&s->reactor, &s->load_timer, FAKE_TICK_MS);
+    reactor_schedule(&s->reactor, &s->probe_timer, s->probe_ms);
+
+    /* The clock only runs once there is load to measure */
+    if (s->duration_ms && !timer_pending(&s->stop_timer))
+        reactor_schedule(&s->reactor, &s->stop_timer, s->duration_ms);
+}
+
+static void _fake_handle(struct fakeircd *s,
+                         struct fake_client *c,
+                         const struct irc_message_view *msg)
+{
+    const char *p0 = irc_view_param(msg, 0);
+    int chan;
+
+    switch (msg->command) {
+        case CMD_NICK: {
+            const char *nick = msg->paramcount ? p0 : irc_view_msg(msg);
+
+            if (c->registered)
+                _fake_send(c, ":%s!bot@localhost NICK :%s", c->nick, nick);
+
+            strncpy(c->nick, nick, sizeof(c->nick) - 1);
+
+            if (!c->registered && c->has_user)
+                _fake_register(s, c);
+
+            break;
+        }
+
+        case CMD_USER:
+            c->has_user = 1;
+
+            if (!c->registered && c->nick[0])
+                _fake_register(s, c);
+
+            break;
+
+        case CMD_PING:
+            _fake_send(c, ":" FAKE_SERVER " PONG " FAKE_SERVER " :%s",
+                    msg->paramcount ? p0 : irc_view_msg(msg));
+            break;
+
+        case CMD_JOIN:
+            if ((chan = _fake_find_channel(s, p0)) >= 0) {
+                _fake_send(c, ":%s!bot@localhost JOIN %s", c->nick, p0);
+                _fake_names(s, c, (unsigned)chan);
+            } else {
+                _fake_send(c, ":" FAKE_SERVER " 403 %s %s :No such channel",
+                        c->nick, p0);
+            }
+
+            break;
+
+        case CMD_PART:
+            _fake_send(c, ":%s!bot@localhost PART %s", c->nick, p0);
+            break;
+
+        case CMD_WHO:
+            if ((chan = _fake_find_channel(s, p0)) >= 0)
+                _fake_who(s, c, (unsigned)chan);
+            else
+                _fake_send(c, ":" FAKE_SERVER " 315 %s %s :End of /WHO list.",
+                        c->nick, p0);
+
+            break;
+
+        case CMD_MODE:
+            if (_fake_find_channel(s, p0) < 0)
+                break;
+
+            if (msg->paramcount == 1)
+                _fake_send(c, ":" FAKE_SERVER " 324 %s %s +nt", c->nick, p0);
+            else if (strchr(irc_view_param(msg, 1), 'b'))
+                _fake_send(c, ":" FAKE_SERVER " 368 %s %s :End of channel ban "
+                        "list", c->nick, p0);
+
+            break;
+
+        case CMD_PRIVMSG:
+            _fake_probe_reply(s, irc_view_msg(msg));
+            break;
+
+        case CMD_QUIT:
+            _fake_send(c, "ERROR :Closing link: %s (Quit)", c->nick);
+            _fake_flush(s);
+            _fake_disconnect(s);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void _fake_on_client(struct reactor *r,
+                            int fd,
+                            unsigned events,
+                            void *arg)
+{
+    struct fakeircd *s = arg;
+    struct fake_client *c = &s->client;
+
+    if (events & REACTOR_READ) {
+        char *dst = NULL;
+        size_t room = linebuf_reserve(&c->in, &dst);
+        ssize_t n = recv(fd, dst, room, 0);
+
+        char *line = NULL;
+        size_t len = 0;
+
+        if (n <= 0) {
+            if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+                return;
+
+            log_info("Client closed the connection");
+
+            _fake_disconnect(s);
+            return;
+        }
+
+        linebuf_commit(&c->in, (size_t)n);
+
+        while (!linebuf_getln(&c->in, &line, &len)) {
+            struct irc_message_view msg;
+
+            s->received++;
+
+            if (!irc_parse_message_view(line, len, &msg))
+                _fake_handle(s, c, &msg);
+
+            if (c->fd < 0)
+                return;
+        }
+    }
+
+    if (c->fd >= 0) {
+        /* Top up whatever the client made room for */
+        if (events & REACTOR_WRITE)
+            _fake_generate(s);
+
+        _fake_flush(s);
+    }
+}
+
+static void _fake_reset_channels(struct fakeircd *s)
+{
+    for (unsigned i = 0; i < s->nchannels; ++i)
+        for (unsigned j = 0; j < s->nusers; ++j) {
+            s->channels[i].users[j].renames = 0;
+            s->channels[i].users[j].present = 1;
+
+            _fake_user_name(s, i, j);
+        }
+}
+
+static void _fake_on_accept(struct reactor *r,
+                            int fd,
+                            unsigned events,
+                            void *arg)
+{
+    struct fakeircd *s = arg;
+    struct fake_client *c = &s->client;
+    int cfd = accept(fd, NULL, NULL);
+
+    if (cfd < 0)
+        return;
+
+    if (c->fd >= 0) {
+        static const char busy[] = "ERROR :Only one client at a time\r\n";
+
+        send(cfd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+        close(cfd);
+        return;
+    }
+
+    fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+
+    c->fd = cfd;
+    c->outlen = 0;
+    c->nick[0] = '\0';
+    c->has_user = 0;
+    c->registered = 0;
+
+    linebuf_init(&c->in);
+    _fake_reset_channels(s);
+
+    if (reactor_add(&s->reactor, cfd, REACTOR_READ, _fake_on_client, s)) {
+        close(cfd);
+        c->fd = -1;
+        return;
+    }
+
+    log_info("Client connected");
+}
+
+static void _fake_disconnect(struct fakeircd *s)
+{
+    struct fake_client *c = &s->client;
+
+    if (c->fd < 0)
+        return;
+
+    reactor_remove(&s->reactor, c->fd);
+    close(c->fd);
+
+    c->fd = -1;
+    c->registered = 0;
+
+    reactor_cancel(&s->reactor, &s->load_timer);
+    reactor_cancel(&s->reactor, &s->probe_timer);
+}
+
+/*
+ * Reporting
+ */
+static void _fake_on_report(struct timer *t, void *arg)
+{
+    struct fakeircd *s = arg;
+
+    if (s->client.registered) {
+        log_info("%lu lines/s, %lu/%lu probes answered",
+                (s->generated - s->last_generated) * 1000 / FAKE_REPORT_MS,
+                s->probes_answered, s->probes_sent);
+
+        s->last_generated = s->generated;
+    }
+
+    reactor_schedule(&s->reactor, &s->report_timer, FAKE_REPORT_MS);
+}
+
+static void _fake_on_stop(struct timer *t, void *arg)
+{
+    struct fakeircd *s = arg;
+
+    s->done = 1;
+}
+
+static int _fake_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double _fake_percentile(const struct fakeircd *s, double q)
+{
+    return (double)s->latencies[(size_t)(q * (double)(s->nlatencies - 1))]
+        / 1e6;
+}
+
+static void _fake_report(struct fakeircd *s)
+{
+    double secs = (double)(clock_mono_ns() - s->load_start) / 1e9;
+
+    if (!s->load_start) {
+        printf("No client ever registered\n");
+        return;
+    }
+
+    printf("%.1f s of load: %u channels x %u users, %u%% churn\n",
+            secs, s->nchannels, s->nusers, s->churn);
+
+    printf("Sent %lu lines, %.0f lines/s sustained; received %lu lines\n",
+            s->generated, secs > 0 ? (double)s->generated / secs : 0.0,
+            s->received);
+
+    printf("Probes: %lu sent, %lu answered\n",
+            s->probes_sent, s->probes_answered);
+
+    if (s->nlatencies) {
+        qsort(s->latencies, s->nlatencies, sizeof(*s->latencies),
+                _fake_cmp_u64);
+
+        printf("Latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+                _fake_percentile(s, 0.50),
+                _fake_percentile(s, 0.90),
+                _fake_percentile(s, 0.99),
+                _fake_percentile(s, 1.00));
+    }
+}
+
+/*
+ * Startup
+ */
+static int _fake_listen(struct fakeircd *s, uint16_t port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if ((s->listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        log_perror("socket()", LOG_ERROR);
+        return 1;
+    }
+
+    setsockopt(s->listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(s->listenfd, (struct sockaddr *)&addr, sizeof(addr))
+            || listen(s->listenfd, 4)) {
+        log_perror("bind()", LOG_ERROR);
+
+        close(s->listenfd);
+        return 1;
+    }
+
+    return reactor_add(&s->reactor, s->listenfd, REACTOR_READ,
+            _fake_on_accept, s);
+}
+
+static int _fake_init(struct fakeircd *s)
+{
+    s->client.outsize = FAKE_OUTBUF_MAX + IRC_MESSAGE_MAX;
+
+    if (!(s->client.out = malloc(s->client.outsize))) {
+        log_perror("malloc()", LOG_ERROR);
+        return 1;
+    }
+
+    if (!(s->channels = calloc(s->nchannels, sizeof(*s->channels)))) {
+        log_perror("calloc()", LOG_ERROR);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < s->nchannels; ++i) {
+        snprintf(s->channels[i].name, sizeof(s->channels[i].name),
+                "#load%u", i);
+
+        if (!(s->channels[i].users = calloc(s->nusers, sizeof(struct fake_user)))) {
+            log_perror("calloc()", LOG_ERROR);
+            return 1;
+        }
+    }
+
+    timer_init(&s->load_timer, _fake_on_load, s);
+    timer_init(&s->probe_timer, _fake_on_probe, s);
+    timer_init(&s->report_timer, _fake_on_report, s);
+    timer_init(&s->stop_timer, _fake_on_stop, s);
+
+    return 0;
+}
+
+static void _fake_destroy(struct fakeircd *s)
+{
+    _fake_disconnect(s);
+
+    if (s->channels)
+        for (unsigned i = 0; i < s->nchannels; ++i)
+            free(s->channels[i].users);
+
+    free(s->channels);
+    free(s->client.out);
+    free(s->latencies);
+}
+
+int print_usage(const char *prgname)
+{
+    printf(
+        "Usage: %s [OPTION]...\n\n"
+        "Stand-in IRC server for load and latency testing, on loopback.\n\n"
+        "  -p, --port=<PORT>     listen on port PORT (default 6667)\n"
+        "  -c, --channels=<N>    join the client to N channels (default 10)\n"
+        "  -u, --users=<N>       with N users each (default 100)\n"
+        "  -r, --rate=<N>        send N lines/s, 0 sends as fast as the "
+                                "client reads\n"
+        "                        (default 1000)\n"
+        "  -x, --churn=<PCT>     make PCT percent of lines joins, parts, "
+                                "quits and\n"
+        "                        nick changes (default 5)\n"
+        "  -i, --probe=<MS>      ask the client to ping every MS "
+                                "milliseconds\n"
+        "                        (default 2500)\n"
+        "  -d, --duration=<SEC>  report and exit after SEC seconds of load, "
+                                "0 runs\n"
+        "                        until interrupted (default 30)\n"
+        "      --help            display this help and exit\n", prgname);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct fakeircd *s;
+    struct sigaction sa;
+
+    struct option lopts[] = {
+        { "help",       no_argument,       NULL,  0  },
+        { "port",       required_argument, NULL, 'p' },
+        { "channels",   required_argument, NULL, 'c' },
+        { "users",      required_argument, NULL, 'u' },
+        { "rate",       required_argument, NULL, 'r' },
+        { "churn",      required_argument, NULL, 'x' },
+        { "probe",      required_argument, NULL, 'i' },
+        { "duration",   required_argument, NULL, 'd' },
+        { NULL,         no_argument,       NULL,  0  }
+    };
+
+    uint16_t portno = 6667;
+    int res = 0;
+
+    /* Big enough to not want it on the stack */
+    if (!(s = calloc(1, sizeof(*s))))
+        return 1;
+
+    s->listenfd = -1;
+    s->client.fd = -1;
+
+    s->nchannels = 10;
+    s->nusers = 100;
+    s->rate = 1000;
+    s->churn = 5;
+    s->probe_ms = 2500;
+    s->duration_ms = 30 * 1000;
+
+    for (;;) {
+        int optidx = 0;
+        int opt = getopt_long(argc, argv, "p:c:u:r:x:i:d:", lopts, &optidx);
+
+        if (opt < 0)
+            break;
+
+        switch (opt) {
+            case 0:
+                if (!strcmp(lopts[optidx].name, "help")) {
+                    free(s);
+                    return print_usage(*argv);
+                }
+
+                break;
+
+            case 'p': portno = (uint16_t)atoi(optarg);                 break;
+            case 'c': s->nchannels = (unsigned)atoi(optarg);           break;
+            case 'u': s->nusers = (unsigned)atoi(optarg);              break;
+            case 'r': s->rate = strtoul(optarg, NULL, 10);             break;
+            case 'x': s->churn = (unsigned)atoi(optarg);               break;
+            case 'i': s->probe_ms = strtoul(optarg, NULL, 10);         break;
+            case 'd': s->duration_ms = strtoul(optarg, NULL, 10) * 1000; break;
+
+            default:
+                free(s);
+                return 1;
+        }
+    }
+
+    if (!s->nchannels || !s->nusers || !s->probe_ms || (s->churn > 100)) {
+        fprintf(stderr, "Need at least one channel and user, a probe "
+                "interval and at most 100%% churn\n");
+
+        free(s);
+        return 1;
+    }
+
+    log_init(NULL);
+    log_set_minlevel(LOG_INFO);
+
+    srand(1);
+
+    if (reactor_init(&s->reactor, NULL)) {
+        free(s);
+        return 1;
+    }
+
+    if (_fake_init(s) || _fake_listen(s, portno)) {
+        res = 1;
+        goto exit;
+    }
+
+    _fake_instance = s;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _fake_sigint;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    log_info("Listening on 127.0.0.1:%u", portno);
+
+    reactor_schedule(&s->reactor, &s->report_timer, FAKE_REPORT_MS);
+
+    while (!s->done)
+        reactor_poll(&s->reactor, -1);
+
+    _fake_report(s);
+
+exit:
+    _fake_instance = NULL;
+
+    if (s->listenfd >= 0)
+        close(s->listenfd);
+
+    _fake_destroy(s);
+    reactor_destroy(&s->reactor);
+    log_destroy();
+
+    free(s);
+
+    return res;
+}
@@ -0,0 +1,535 @@
+#define _POSIX_C_SOURCE 200809L
+
+/*
+ * microbench - microbenchmarks for the primitives every received line goes
+ * through, run by `make bench'.
+ *
+ * Each benchmark runs one operation on the next item of a corpus of realistic
+ * input, round robin, doubling the number of operations until a run takes at
+ * least the target time. The last run is reported as one tab separated line:
+ *
+ *   name  iterations  ns/op  allocs/op  bytes/op  MB/s
+ *
+ * bytes/op is the amount of input an operation consumes, if that means
+ * anything for it, and MB/s follows from it. Where either does not apply, or
+ * allocations cannot be counted (only on glibc, by interposing malloc), the
+ * column reads "-". Lines starting with '#' are comments.
+ *
+ * Output of two builds can be compared line by line, e.g. with join(1).
+ */
+#include "irc/irc.h"
+#include "irc/util.h"
+#include "irc/channel.h"
+#include "irc/session.h"
+#include "util/clock.h"
+#include "util/linebuf.h"
+#include "util/log.h"
+#include "util/tokenbucket.h"
+#include "util/util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_TARGET_MS 200 /* default minimum duration of a run */
+
+/*
+ * Allocation counting
+ */
+#ifdef __GLIBC__
+#   define BENCH_COUNT_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+static unsigned long _bench_allocs = 0;
+
+void *malloc(size_t size)
+{
+    _bench_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    _bench_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    _bench_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+/* Results go here, so the compiler cannot drop the work */
+static volatile uintptr_t _bench_sink;
+
+/*
+ * Corpora
+ */
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const char *_bench_lines[] = {
+    ":irc.example.net 001 Mako :Welcome to the Example IRC Network "
+        "Mako!mako@host.example.com",
+    ":irc.example.net 005 Mako CHANTYPES=# EXCEPTS INVEX "
+        "CHANMODES=eIbq,k,flj,CFLMPQScgimnprstuz CHANLIMIT=#:120 "
+        "PREFIX=(ov)@+ MAXLIST=bqeI:100 MODES=4 NETWORK=Example KNOCK "
+        "STATUSMSG=@+ CALLERID=g :are supported by this server",
+    ":irc.example.net 353 Mako = #chan :@ChanServ +alice bob carol dave eve "
+        "mallory trent victor walter",
+    ":irc.example.net 352 Mako #chan ~alice 2001:db8::1 irc.example.net "
+        "alice H@ :0 Alice Liddell",
+    ":irc.example.net 324 Mako #chan +ntl 50",
+    ":irc.example.net 367 Mako #chan *!*@evil.example.org ChanServ "
+        "1700000000",
+    ":irc.example.net 433 * Mako :Nickname is already in use.",
+    ":alice!~alice@2001:db8::1 PRIVMSG #chan :has anyone tried the new "
+        "release yet?",
+    ":bob!bob@203.0.113.7 PRIVMSG #chan :Mako: ping",
+    ":carol!~c@gateway/web/irccloud.com/x-abcdefgh PRIVMSG Mako "
+        ":\001VERSION\001",
+    ":bob!bob@203.0.113.7 PRIVMSG #chan :a somewhat longer message, the kind "
+        "people write when explaining something in more detail than strictly "
+        "necessary, with punctuation and all!",
+    ":alice!~alice@2001:db8::1 NOTICE Mako :hi there",
+    ":dave!dave@198.51.100.23 JOIN #chan",
+    ":eve!~eve@user/eve PART #chan :Leaving",
+    ":mallory!m@evil.example.org QUIT :Ping timeout: 260 seconds",
+    ":trent!t@203.0.113.99 NICK :trent_",
+    ":ChanServ!ChanServ@services. MODE #chan +o-v+b alice bob "
+        "*!*@evil.example.org",
+    ":walter!w@198.51.100.1 KICK #chan mallory :spam",
+    ":victor!v@198.51.100.2 TOPIC #chan :Welcome | rules: be nice | logs at "
+        "https://example.org/logs",
+    "PING :irc.example.net"
+};
+
+static const char *_bench_commands[] = {
+    "PRIVMSG", "PRIVMSG", "PRIVMSG", "PRIVMSG", "NOTICE", "JOIN", "PART",
+    "QUIT", "NICK", "MODE", "KICK", "TOPIC", "PING", "001", "005", "353",
+    "352", "366", "324", "433", "CAP", "AUTHENTICATE", "999"
+};
+
+struct bench_pair
+{
+    const char *a;
+    const char *b;
+};
+
+/* Prefixes and the kind of masks they are checked against, matching or not */
+static const struct bench_pair _bench_masks[] = {
+    { "alice!~alice@2001:db8::1",            "*!*@2001:db8::*"              },
+    { "bob!bob@203.0.113.7",                 "*!*bob@203.0.113.*"           },
+    { "carol!~c@gateway/web/irccloud.com/x-abcdefgh",
+                                             "*!*@gateway/web/irccloud.com/*" },
+    { "eve!~eve@user/eve",                   "eve!*@*"                      },
+    { "mallory!m@evil.example.org",          "*!*@*.example.net"            },
+    { "trent!t@203.0.113.99",                "tr?nt!*@*"                    },
+    { "walter!w@198.51.100.1",               "*!*@198.51.100.?"             },
+    { "victor!v@198.51.100.2",               "*"                            }
+};
+
+/* Masks with many stars that almost match, which makes naive matchers retry */
+static const struct bench_pair _bench_masks_pathological[] = {
+    { "aaaaaaaaaaaaaaaaaaaaaaaa!a@a",       "*a*a*a*a*b"                     },
+    { "nick!user@a.very.long.host.name.with.many.dots.example.org",
+                                            "*.*.*.*.*.*.*.*.net"            },
+    { "x!x@xxxxxxxxxxxxxxxxxxxxxxxxxxxx",   "*x*?*x*?*y"                     }
+};
+
+static const struct bench_pair _bench_users[] = {
+    { "alice!~alice@2001:db8::1",  "Alice!x@y"                  },
+    { "alice",                     "alice!~alice@2001:db8::1"   },
+    { "bob!bob@203.0.113.7",       "bobby!bob@203.0.113.7"      },
+    { "carol!~c@gateway/web/x",    "dave!dave@198.51.100.23"    },
+    { "ChanServ!ChanServ@services.", "chanserv"                 }
+};
+
+/* Registered user masks (see bot/reguser.c) and prefixes to check */
+static const struct bench_pair _bench_regexes[] = {
+    { "^alice!.*@2001:db8::.*$",            "alice!~alice@2001:db8::1"    },
+    { "^bob!bob@203\\.0\\.113\\.[0-9]+$",   "bob!bob@203.0.113.7"         },
+    { "^[^!]+!.*@user/eve$",                "eve!~eve@user/eve"           },
+    { "^admin!.*@.*\\.example\\.org$",      "mallory!m@evil.example.org"  }
+};
+
+/* Channel modes set and unset again, as in CHANMODES=b,k,l,imnpst */
+static const struct bench_pair _bench_modes[] = {
+    { "n", ""                   },
+    { "k", "hunter2"            },
+    { "t", ""                   },
+    { "l", "42"                 },
+    { "b", "*!*@203.0.113.7"    },
+    { "i", ""                   }
+};
+
+/*
+ * Benchmarks. Each operation works on corpus item i (modulo its size) and
+ * returns the number of input bytes it consumed.
+ */
+static struct irc_message _bench_parsed[ARRAY_SIZE(_bench_lines)];
+static size_t _bench_lens[ARRAY_SIZE(_bench_lines)];
+
+static struct irc_session _bench_sess;
+static char _bench_stream[LINEBUF_MAX / 2];
+static size_t _bench_stream_len;
+
+static struct irc_session _bench_chan_sess;
+static struct irc_channel *_bench_chan;
+static struct irc_channel *_bench_bans;
+
+/* Bans already set on _bench_bans, while one more comes and goes */
+#define BENCH_BANS 500
+
+static struct clock_virtual _bench_clock;
+static struct tokenbucket _bench_bucket;
+
+static void _bench_init_lines(void)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(_bench_lines); ++i) {
+        _bench_lens[i] = strlen(_bench_lines[i]);
+
+        irc_parse_message(_bench_lines[i], &_bench_parsed[i]);
+    }
+}
+
+static size_t _bench_parse(size_t i)
+{
+    struct irc_message msg;
+
+    i %= ARRAY_SIZE(_bench_lines);
+
+    _bench_sink += (uintptr_t)irc_parse_message(_bench_lines[i], &msg);
+    _bench_sink += (uintptr_t)msg.paramcount;
+
+    return _bench_lens[i];
+}
+
+static size_t _bench_parse_view(size_t i)
+{
+    struct irc_message_view msg;
+    char line[IRC_MESSAGE_MAX];
+
+    i %= ARRAY_SIZE(_bench_lines);
+
+    /* Parsing terminates tokens in place, which includes the copy */
+    memcpy(line, _bench_lines[i], _bench_lens[i] + 1);
+
+    _bench_sink += (uintptr_t)irc_parse_message_view(line, _bench_lens[i], &msg);
+    _bench_sink += (uintptr_t)msg.paramcount;
+
+    return _bench_lens[i];
+}
+
+static size_t _bench_serialize(size_t i)
+{
+    char buf[IRC_MESSAGE_MAX];
+
+    i %= ARRAY_SIZE(_bench_lines);
+
+    _bench_sink += (uintptr_t)irc_message_to_string(&_bench_parsed[i],
+            buf, sizeof(buf));
+
+    return _bench_lens[i];
+}
+
+static size_t _bench_command(size_t i)
+{
+    const char *cmd = _bench_commands[i % ARRAY_SIZE(_bench_commands)];
+
+    _bench_sink += (uintptr_t)irc_string_to_command(cmd);
+
+    return 0;
+}
+
+static size_t _bench_wildcard(size_t i)
+{
+    const struct bench_pair *p = &_bench_masks[i % ARRAY_SIZE(_bench_masks)];
+
+    _bench_sink += (uintptr_t)irc_strwcmp(p->a, p->b);
+
+    return 0;
+}
+
+static size_t _bench_wildcard_pathological(size_t i)
+{
+    const struct bench_pair *p = &_bench_masks_pathological[
+        i % ARRAY_SIZE(_bench_masks_pathological)];
+
+    _bench_sink += (uintptr_t)irc_strwcmp(p->a, p->b);
+
+    return 0;
+}
+
+static size_t _bench_user_cmp(size_t i)
+{
+    const struct bench_pair *p = &_bench_users[i % ARRAY_SIZE(_bench_users)];
+
+    _bench_sink += (uintptr_t)irc_user_cmp(p->a, p->b);
+
+    return 0;
+}
+
+static size_t _bench_regex(size_t i)
+{
+    const struct bench_pair *p = &_bench_regexes[i % ARRAY_SIZE(_bench_regexes)];
+
+    _bench_sink += (uintptr_t)regex_match(p->a, p->b);
+
+    return 0;
+}
+
+static void _bench_init_getln(void)
+{
+    _bench_init_lines();
+    _bench_stream_len = 0;
+
+    /* As much of the corpus as fits, the way it would arrive */
+    for (size_t i = 0; i < ARRAY_SIZE(_bench_lines); ++i) {
+        if (_bench_stream_len + _bench_lens[i] + 2 > sizeof(_bench_stream))
+            break;
+
+        memcpy(_bench_stream + _bench_stream_len, _bench_lines[i],
+                _bench_lens[i]);
+        memcpy(_bench_stream + _bench_stream_len + _bench_lens[i], "\r\n", 2);
+
+        _bench_stream_len += _bench_lens[i] + 2;
+    }
+
+    linebuf_init(&_bench_sess.buffer);
+}
+
+static size_t _bench_getln(size_t i)
+{
+    char *line = NULL;
+    size_t len = 0;
+
+    /* Stands in for recv(), once the buffer runs dry */
+    while (sess_getln(&_bench_sess, &line, &len)) {
+        char *dst = NULL;
+        size_t room = linebuf_reserve(&_bench_sess.buffer, &dst);
+        size_t n = MIN(room, _bench_stream_len);
+
+        memcpy(dst, _bench_stream, n);
+        linebuf_commit(&_bench_sess.buffer, n);
+    }
+
+    _bench_sink += (uintptr_t)line[0];
+
+    return len + 2;
+}
+
+static void _bench_init_tokenbucket(void)
+{
+    clock_virtual_init(&_bench_clock);
+    clock_set_source(&_bench_clock.source);
+
+    tokenbucket_init(&_bench_bucket, 1000, 100);
+}
+
+static size_t _bench_tokenbucket(size_t i)
+{
+    /* A microsecond passes between two messages */
+    clock_virtual_advance(&_bench_clock, 1000);
+
+    tokenbucket_generate(&_bench_bucket);
+    _bench_sink += (uintptr_t)tokenbucket_consume(&_bench_bucket, 1);
+
+    return 0;
+}
+
+static void _bench_init_channel_mode(void)
+{
+    if (_bench_chan)
+        return;
+
+    sess_init(&_bench_chan_sess, "localhost", 6667, "bench", "bench", "", "");
+
+    strcpy(_bench_chan_sess.chanmodes[MODE_LIST], "b");
+    strcpy(_bench_chan_sess.chanmodes[MODE_REQARG], "k");
+    strcpy(_bench_chan_sess.chanmodes[MODE_SETARG], "l");
+    strcpy(_bench_chan_sess.chanmodes[MODE_NOARG], "imnpst");
+
+    irc_channel_add(&_bench_chan_sess, "#bench");
+    _bench_chan = irc_channel_get(&_bench_chan_sess, "#bench");
+}
+
+static size_t _bench_channel_mode(size_t i)
+{
+    const struct bench_pair *p = &_bench_modes[i % ARRAY_SIZE(_bench_modes)];
+
+    irc_channel_set_mode(_bench_chan, p->a[0], p->b, "bench!b@localhost", 0);
+    _bench_sink += (uintptr_t)irc_channel_has_mode(_bench_chan, p->a[0]);
+    irc_channel_unset_mode(_bench_chan, p->a[0], p->b);
+
+    return 0;
+}
+
+static void _bench_init_ban_churn(void)
+{
+    char mask[64];
+
+    if (_bench_bans)
+        return;
+
+    _bench_init_channel_mode();
+
+    irc_channel_add(&_bench_chan_sess, "#bans");
+    _bench_bans = irc_channel_get(&_bench_chan_sess, "#bans");
+
+    for (int i = 0; i < BENCH_BANS; ++i) {
+        snprintf(mask, sizeof(mask), "*!*@198.51.%d.%d", i / 256, i % 256);
+        irc_channel_set_mode(_bench_bans, 'b', mask, "bench!b@localhost", 0);
+    }
+}
+
+static size_t _bench_ban_churn(size_t i)
+{
+    const char *mask = "*!*@203.0.113.7";
+
+    irc_channel_set_mode(_bench_bans, 'b', mask, "bench!b@localhost", 0);
+    _bench_sink += (uintptr_t)irc_channel_has_mode(_bench_bans, 'b');
+    irc_channel_unset_mode(_bench_bans, 'b', mask);
+
+    return 0;
+}
+
+/*
+ * Driver
+ */
+struct bench
+{
+    const char *name;
+
+    void   (*init)(void);
+    size_t (*op)(size_t i);
+};
+
+static const struct bench _benchmarks[] = {
+    { "irc_parse_message",          _bench_init_lines,       _bench_parse },
+    { "irc_parse_message_view",     _bench_init_lines,       _bench_parse_view },
+    { "irc_message_to_string",      _bench_init_lines,       _bench_serialize },
+    { "irc_string_to_command",      NULL,                    _bench_command },
+    { "irc_strwcmp",                NULL,                    _bench_wildcard },
+    { "irc_strwcmp_pathological",   NULL,              _bench_wildcard_pathological },
+    { "irc_user_cmp",               NULL,                    _bench_user_cmp },
+    { "regex_match",                NULL,                    _bench_regex },
+    { "irc_channel_mode",           _bench_init_channel_mode, _bench_channel_mode },
+    { "irc_channel_ban_churn",      _bench_init_ban_churn,   _bench_ban_churn },
+    { "sess_getln",                 _bench_init_getln,       _bench_getln },
+    { "tokenbucket",                _bench_init_tokenbucket, _bench_tokenbucket }
+};
+
+static void _bench_run(const struct bench *b, uint64_t target_ns)
+{
+    unsigned long allocs = 0;
+    uint64_t elapsed = 0;
+    uint64_t bytes = 0;
+    uint64_t start = 0;
+    size_t iters = 1;
+
+    if (b->init)
+        b->init();
+
+    /* Warm up caches and lazily initialized tables, but not for too long */
+    start = clock_system_ns();
+
+    for (size_t i = 0; i < 1000; ++i)
+        if ((b->op(i), clock_system_ns() - start) > target_ns / 10)
+            break;
+
+    for (;;) {
+#ifdef BENCH_COUNT_ALLOCS
+        allocs = _bench_allocs;
+#endif
+        bytes = 0;
+        start = clock_system_ns();
+
+        for (size_t i = 0; i < iters; ++i)
+            bytes += b->op(i);
+
+        elapsed = clock_system_ns() - start;
+
+#ifdef BENCH_COUNT_ALLOCS
+        allocs = _bench_allocs - allocs;
+#endif
+
+        if ((elapsed >= target_ns) || (iters > SIZE_MAX / 2))
+            break;
+
+        iters *= 2;
+    }
+
+    printf("%s\t%zu\t%.2f\t", b->name, iters, (double)elapsed / (double)iters);
+
+#ifdef BENCH_COUNT_ALLOCS
+    printf("%.2f\t", (double)allocs / (double)iters);
+#else
+    printf("-\t");
+#endif
+
+    if (bytes)
+        printf("%.1f\t%.1f\n",
+                (double)bytes / (double)iters,
+                ((double)bytes / 1e6) / ((double)elapsed / 1e9));
+    else
+        printf("-\t-\n");
+
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long target_ms = BENCH_TARGET_MS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) >= 0) {
+        switch (opt) {
+            case 't':
+                target_ms = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-t MS] [BENCHMARK]...\n\n"
+                        "  -t MS  run each benchmark for at least MS "
+                        "milliseconds (default %d)\n", *argv, BENCH_TARGET_MS);
+
+                return 1;
+        }
+    }
+
+    /* sess_getln() logs every line at debug level */
+    log_init(NULL);
+    log_set_minlevel(LOG_WARNING);
+
+    printf("# benchmark\titerations\tns/op\tallocs/op\tbytes/op\tMB/s\n");
+
+    for (size_t i = 0; i < ARRAY_SIZE(_benchmarks); ++i) {
+        const struct bench *b = &_benchmarks[i];
+        int selected = (optind == argc);
+
+        /* Run only the benchmarks named on the command line, if any */
+        for (int j = optind; j < argc; ++j)
+            if (!strcmp(argv[j], b->name))
+                selected = 1;
+
+        if (selected)
+            _bench_run(b, (uint64_t)target_ms * UINT64_C(1000000));
+    }
+
+    log_destroy();
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "util/clock.h"
+#include "util/log.h"
+
+#include <string.h>
+
+
+static struct
+{
+    const struct clock_source *src;
+    int sampled;
+
+    uint64_t mono;
+    time_t real;
+
+    /* Timestamp string and the second it was formatted for */
+    char timestamp[TIMEBUF_MAX];
+    time_t timestamp_at;
+} _clock;
+
+
+static uint64_t _clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+
+    return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+static void _clock_system_sample(const struct clock_source *src,
+                                 uint64_t *mono,
+                                 time_t *real)
+{
+    *mono = _clock_ns(CLOCK_MONOTONIC);
+    *real = time(NULL);
+}
+
+const struct clock_source clock_source_system = {
+    .name = "system",
+    .sample = _clock_system_sample,
+    .manual = 0
+};
+
+void clock_set_source(const struct clock_source *src)
+{
+    _clock.src = src ? src : &clock_source_system;
+
+    clock_update();
+}
+
+const struct clock_source *clock_get_source(void)
+{
+    return _clock.src ? _clock.src : &clock_source_system;
+}
+
+void clock_update(void)
+{
+    const struct clock_source *src = clock_get_source();
+
+    src->sample(src, &_clock.mono, &_clock.real);
+    _clock.sampled = 1;
+}
+
+uint64_t clock_mono_ns(void)
+{
+    if (!_clock.sampled)
+        clock_update();
+
+    return _clock.mono;
+}
+
+uint64_t clock_mono_ms(void)
+{
+    return clock_mono_ns() / UINT64_C(1000000);
+}
+
+time_t clock_time(void)
+{
+    if (!_clock.sampled)
+        clock_update();
+
+    return _clock.real;
+}
+
+uint64_t clock_system_ns(void)
+{
+    return _clock_ns(CLOCK_MONOTONIC);
+}
+
+const char *clock_timestamp(void)
+{
+    time_t now = clock_time();
+
+    if ((now != _clock.timestamp_at) || (_clock.timestamp[0] == '\0')) {
+        strftime(_clock.timestamp, sizeof(_clock.timestamp),
+                STRFTIME_FORMAT, TIME_GETTIME(&now));
+
+        _clock.timestamp_at = now;
+    }
+
+    return _clock.timestamp;
+}
+
+static void _clock_virtual_sample(const struct clock_source *src,
+                                  uint64_t *mono,
+                                  time_t *real)
+{
+    /* Source is the first member */
+    const struct clock_virtual *vc = (const struct clock_virtual *)src;
+
+    *mono = vc->mono;
+    *real = (time_t)(vc->real / UINT64_C(1000000000));
+}
+
+void clock_virtual_init(struct clock_virtual *vc)
+{
+    memset(vc, 0, sizeof(*vc));
+
+    vc->source.name = "virtual";
+    vc->source.sample = _clock_virtual_sample;
+    vc->source.manual = 1;
+
+    /* Take over seamlessly from the system clock */
+    vc->mono = _clock_ns(CLOCK_MONOTONIC);
+    vc->real = _clock_ns(CLOCK_REALTIME);
+}
+
+void clock_virtual_advance(struct clock_virtual *vc, uint64_t ns)
+{
+    vc->mono += ns;
+    vc->real += ns;
+
+    if (clock_get_source() == &vc->source)
+        clock_update();
+}
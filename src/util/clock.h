@@ -0,0 +1,92 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Clock service.
+ *
+ * The monotonic and the wall clock are sampled together by clock_update(),
+ * once per event loop iteration right after waiting for events, and every
+ * accessor returns those samples. Everything handling the same batch of events
+ * sees the same time, and asking for it costs nothing.
+ *
+ * The first access samples the clocks if clock_update() has not been called
+ * yet. Code that blocks for a noticeable amount of time should call
+ * clock_update() afterwards.
+ *
+ * Where the time comes from is up to the clock source, which is the system's
+ * clocks unless replaced. A virtual clock only moves when told to, so a
+ * harness can run hours of timeouts, flood protection and timers in an
+ * instant. Only the reactor's timer wheel follows the clock source, timer fds
+ * always run on system time.
+ */
+struct clock_source
+{
+    const char *name;
+
+    /* Current monotonic time in nanoseconds and wall clock in seconds */
+    void (*sample)(const struct clock_source *src,
+                   uint64_t *mono,
+                   time_t *real);
+
+    /*
+     * Set if time only moves when the source's owner says so. Nothing is
+     * worth waiting for in that case, see reactor_poll().
+     */
+    int manual;
+};
+
+extern const struct clock_source clock_source_system;
+
+/*
+ * Switch to another source (NULL for the system's clocks) and sample it. Time
+ * must not go backwards when switching.
+ */
+void clock_set_source(const struct clock_source *src);
+const struct clock_source *clock_get_source(void);
+
+void clock_update(void);
+
+/* CLOCK_MONOTONIC */
+uint64_t clock_mono_ns(void);
+uint64_t clock_mono_ms(void);
+
+/* CLOCK_REALTIME, in seconds */
+time_t clock_time(void);
+
+/*
+ * The system's CLOCK_MONOTONIC, read on every call regardless of the source.
+ * Only meant for measuring how long something takes.
+ */
+uint64_t clock_system_ns(void);
+
+/*
+ * The wall clock formatted as STRFTIME_FORMAT (see util/log.h). The string is
+ * only formatted again once the second has changed, and remains valid until
+ * then.
+ */
+const char *clock_timestamp(void);
+
+/*
+ * Virtual clock, starting out at the current system time so it can take over
+ * at any point
+ */
+struct clock_virtual
+{
+    struct clock_source source;
+
+    uint64_t mono;
+    uint64_t real; /* in nanoseconds */
+};
+
+void clock_virtual_init(struct clock_virtual *vc);
+
+/*
+ * Move the clock forward. If it is the current source, the new time is
+ * sampled right away.
+ */
+void clock_virtual_advance(struct clock_virtual *vc, uint64_t ns);
+
+#endif /* defined CLOCK_H */
@@ -0,0 +1,382 @@
+#include "util/intern.h"
+#include "util/log.h"
+
+#include <stddef.h>
+#include <string.h>
+
+
+#define INTERN_BUCKETS 256
+#define INTERN_MAP_BUCKETS 8
+
+struct istr
+{
+    struct istr *next;
+
+    unsigned long hash;
+    unsigned long refs;
+    size_t len;
+
+    char str[];
+};
+
+#define ISTR(s) ((struct istr *)((char *)(s) - offsetof(struct istr, str)))
+
+/* Object sizes of the slab caches, header included */
+static const size_t _intern_class_size[INTERN_CLASSES] = {
+    48, 64, 96, 128, 192
+};
+
+static const char *_intern_class_name[INTERN_CLASSES] = {
+    "strings/48", "strings/64", "strings/96", "strings/128", "strings/192"
+};
+
+/* Cache for a string of the given length, NULL if it is too long for any */
+static struct slab_cache *_intern_class(struct intern_table *t, size_t len)
+{
+    for (int c = 0; c < INTERN_CLASSES; ++c)
+        if (sizeof(struct istr) + len + 1 <= _intern_class_size[c])
+            return &t->classes[c];
+
+    return NULL;
+}
+
+
+/* FNV-1a */
+static unsigned long _intern_hash(const char *s, size_t *len)
+{
+    const char *p = s;
+    unsigned long h = 2166136261UL;
+
+    for (; *p; ++p)
+        h = ((h ^ (unsigned char)*p) * 16777619UL) & 0xffffffffUL;
+
+    *len = (size_t)(p - s);
+
+    return h;
+}
+
+static struct istr *_intern_lookup(const struct intern_table *t,
+                                   const char *s,
+                                   unsigned long hash,
+                                   size_t len)
+{
+    struct istr *i = t->buckets[hash & (t->nbuckets - 1)];
+
+    for (; i; i = i->next)
+        if ((i->hash == hash) && (i->len == len) && !memcmp(i->str, s, len))
+            return i;
+
+    return NULL;
+}
+
+static void _intern_grow(struct intern_table *t)
+{
+    size_t n = t->nbuckets * 2;
+    struct istr **buckets = calloc(n, sizeof(*buckets));
+
+    /* Longer chains are only slower, not wrong */
+    if (!buckets)
+        return;
+
+    for (size_t b = 0; b < t->nbuckets; ++b) {
+        struct istr *i = t->buckets[b];
+
+        while (i) {
+            struct istr *next = i->next;
+
+            i->next = buckets[i->hash & (n - 1)];
+            buckets[i->hash & (n - 1)] = i;
+
+            i = next;
+        }
+    }
+
+    free(t->buckets);
+
+    t->buckets = buckets;
+    t->nbuckets = n;
+}
+
+
+int intern_init(struct intern_table *t)
+{
+    memset(t, 0, sizeof(*t));
+
+    if (!(t->buckets = calloc(INTERN_BUCKETS, sizeof(*t->buckets)))) {
+        log_error("intern_init(): not enough memory for allocation");
+        return 1;
+    }
+
+    t->nbuckets = INTERN_BUCKETS;
+
+    for (int c = 0; c < INTERN_CLASSES; ++c)
+        slab_cache_init(&t->classes[c],
+                _intern_class_name[c], _intern_class_size[c]);
+
+    return 0;
+}
+
+void intern_destroy(struct intern_table *t)
+{
+    if (t->count)
+        log_debug("intern table destroyed with %zu strings still referenced",
+                t->count);
+
+    for (size_t b = 0; b < t->nbuckets; ++b) {
+        struct istr *i = t->buckets[b];
+
+        while (i) {
+            struct istr *next = i->next;
+
+            if (!_intern_class(t, i->len))
+                free(i);
+
+            i = next;
+        }
+    }
+
+    for (int c = 0; c < INTERN_CLASSES; ++c)
+        slab_cache_destroy(&t->classes[c]);
+
+    free(t->buckets);
+    memset(t, 0, sizeof(*t));
+}
+
+const char *intern(struct intern_table *t, const char *s)
+{
+    size_t len;
+    unsigned long hash = _intern_hash(s, &len);
+
+    struct istr *i = _intern_lookup(t, s, hash, len);
+
+    if (!i) {
+        struct slab_cache *c = _intern_class(t, len);
+
+        if (!(i = c ? slab_alloc(c) : malloc(sizeof(*i) + len + 1))) {
+            log_error("intern(): not enough memory for allocation");
+            return NULL;
+        }
+
+        i->hash = hash;
+        i->refs = 0;
+        i->len = len;
+        memcpy(i->str, s, len + 1);
+
+        i->next = t->buckets[hash & (t->nbuckets - 1)];
+        t->buckets[hash & (t->nbuckets - 1)] = i;
+
+        t->count++;
+        t->bytes += len + 1;
+
+        if (t->count > t->nbuckets)
+            _intern_grow(t);
+    }
+
+    i->refs++;
+    t->refs++;
+
+    return i->str;
+}
+
+const char *intern_find(const struct intern_table *t, const char *s)
+{
+    size_t len;
+    unsigned long hash = _intern_hash(s, &len);
+
+    struct istr *i = _intern_lookup(t, s, hash, len);
+
+    return i ? i->str : NULL;
+}
+
+const char *intern_ref(struct intern_table *t, const char *s)
+{
+    ISTR(s)->refs++;
+    t->refs++;
+
+    return s;
+}
+
+void intern_release(struct intern_table *t, const char *s)
+{
+    struct istr *i = NULL;
+    struct istr **pos = NULL;
+    struct slab_cache *c = NULL;
+
+    if (!s)
+        return;
+
+    i = ISTR(s);
+    t->refs--;
+
+    if (--i->refs)
+        return;
+
+    for (pos = &t->buckets[i->hash & (t->nbuckets - 1)]; *pos != i;)
+        pos = &(*pos)->next;
+
+    *pos = i->next;
+
+    t->count--;
+    t->bytes -= i->len + 1;
+
+    if ((c = _intern_class(t, i->len)))
+        slab_free(c, i);
+    else
+        free(i);
+}
+
+int intern_set(struct intern_table *t, const char **slot, const char *s)
+{
+    const char *str = NULL;
+
+    if (*slot && !strcmp(*slot, s))
+        return 0;
+
+    if (!(str = intern(t, s)))
+        return 1;
+
+    intern_release(t, *slot);
+    *slot = str;
+
+    return 0;
+}
+
+size_t intern_len(const char *s)
+{
+    return ISTR(s)->len;
+}
+
+unsigned long intern_hash(const void *s)
+{
+    return ISTR(s)->hash;
+}
+
+bool intern_equal(const void *a, const void *b)
+{
+    return a == b;
+}
+
+
+/* Intrusive maps */
+static int _intern_map_grow(struct intern_map *m)
+{
+    size_t n = m->nbuckets ? m->nbuckets * 2 : INTERN_MAP_BUCKETS;
+    struct intern_node **buckets = calloc(n, sizeof(*buckets));
+
+    if (!buckets)
+        return 1;
+
+    for (size_t b = 0; b < m->nbuckets; ++b) {
+        struct intern_node *i = m->buckets[b];
+
+        while (i) {
+            struct intern_node *next = i->next;
+
+            i->next = buckets[intern_hash(i->key) & (n - 1)];
+            buckets[intern_hash(i->key) & (n - 1)] = i;
+
+            i = next;
+        }
+    }
+
+    free(m->buckets);
+
+    m->buckets = buckets;
+    m->nbuckets = n;
+
+    return 0;
+}
+
+void intern_map_init(struct intern_map *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+void intern_map_destroy(struct intern_map *m)
+{
+    free(m->buckets);
+    memset(m, 0, sizeof(*m));
+}
+
+int intern_map_insert(struct intern_map *m,
+                      struct intern_node *n,
+                      const char *key)
+{
+    struct intern_node **b = NULL;
+
+    /* Longer chains are only slower, as long as there is a bucket at all */
+    if ((m->count >= m->nbuckets) && _intern_map_grow(m) && !m->nbuckets) {
+        log_error("intern_map_insert(): not enough memory for allocation");
+        return 1;
+    }
+
+    b = &m->buckets[intern_hash(key) & (m->nbuckets - 1)];
+
+    n->key = key;
+    n->next = *b;
+    *b = n;
+
+    m->count++;
+
+    return 0;
+}
+
+void intern_map_remove(struct intern_map *m, struct intern_node *n)
+{
+    struct intern_node **pos = NULL;
+
+    if (!m->nbuckets)
+        return;
+
+    for (pos = &m->buckets[intern_hash(n->key) & (m->nbuckets - 1)];
+            *pos; pos = &(*pos)->next) {
+        if (*pos == n) {
+            *pos = n->next;
+            m->count--;
+
+            return;
+        }
+    }
+}
+
+struct intern_node *intern_map_lookup(const struct intern_map *m,
+                                      const char *key)
+{
+    struct intern_node *n = NULL;
+
+    if (!m->nbuckets)
+        return NULL;
+
+    for (n = m->buckets[intern_hash(key) & (m->nbuckets - 1)]; n; n = n->next)
+        if (n->key == key)
+            return n;
+
+    return NULL;
+}
+
+void intern_map_iterator_init(struct intern_map_iterator *it,
+                              const struct intern_map *m)
+{
+    it->map = m;
+    it->bucket = 0;
+    it->node = NULL;
+
+    /* Always one ahead, so the node handed out can go away */
+    while (!it->node && (it->bucket < m->nbuckets))
+        it->node = m->buckets[it->bucket++];
+}
+
+struct intern_node *intern_map_iterator_next(struct intern_map_iterator *it)
+{
+    struct intern_node *n = it->node;
+
+    if (!n)
+        return NULL;
+
+    it->node = n->next;
+
+    while (!it->node && (it->bucket < it->map->nbuckets))
+        it->node = it->map->buckets[it->bucket++];
+
+    return n;
+}
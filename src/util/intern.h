@@ -0,0 +1,112 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "util/slab.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/*
+ * Interned strings: every distinct string is stored once per table, along with
+ * its length, its hash and a reference count. They are handed out as plain
+ * const char pointers, so two strings interned in the same table are equal if
+ * and only if the pointers are.
+ *
+ * Interned strings must never be written to, and every reference taken with
+ * intern() or intern_ref() has to be given back with intern_release().
+ */
+struct istr;
+
+/*
+ * Strings up to the largest class are carved out of slab caches by size, only
+ * longer ones are malloc'd on their own
+ */
+#define INTERN_CLASSES 5
+
+struct intern_table
+{
+    struct istr **buckets;
+    size_t nbuckets; /* always a power of two */
+
+    struct slab_cache classes[INTERN_CLASSES];
+
+    /* Statistics */
+    size_t count;    /* distinct strings */
+    size_t refs;     /* references held on them */
+    size_t bytes;    /* string bytes stored */
+};
+
+int  intern_init(struct intern_table *t);
+void intern_destroy(struct intern_table *t);
+
+/* Returns a new reference to the interned copy of s, or NULL */
+const char *intern(struct intern_table *t, const char *s);
+
+/* Returns the interned copy of s without taking a reference, or NULL */
+const char *intern_find(const struct intern_table *t, const char *s);
+
+/* Another reference to a string already interned in t */
+const char *intern_ref(struct intern_table *t, const char *s);
+
+/* Gives back a reference, the last one frees the string. NULL is fine. */
+void intern_release(struct intern_table *t, const char *s);
+
+/*
+ * Replace the interned string in *slot with s, unless they are the same.
+ * Returns 0 on success, on failure *slot is left alone.
+ */
+int intern_set(struct intern_table *t, const char **slot, const char *s);
+
+size_t intern_len(const char *s);
+
+/* For hashtables keyed by interned strings, hash and compare pointers only */
+unsigned long intern_hash(const void *s);
+bool intern_equal(const void *a, const void *b);
+
+/*
+ * Intrusive hash maps keyed by interned strings. Nodes live in the structures
+ * they index, so nothing is allocated per entry, only the bucket array grows
+ * now and then. A map does not hold references on its keys.
+ */
+struct intern_node
+{
+    struct intern_node *next;
+    const char *key;
+};
+
+struct intern_map
+{
+    struct intern_node **buckets;
+    size_t nbuckets; /* 0 until the first insert */
+    size_t count;
+};
+
+struct intern_map_iterator
+{
+    const struct intern_map *map;
+    size_t bucket;
+    struct intern_node *node;
+};
+
+#define intern_map_entry(node, type, member) \
+    ((type *)((char *)(node) - offsetof(type, member)))
+
+void intern_map_init(struct intern_map *m);
+void intern_map_destroy(struct intern_map *m);
+
+/* Returns 0 on success, the key must not be in the map yet */
+int  intern_map_insert(struct intern_map *m,
+                       struct intern_node *n,
+                       const char *key);
+void intern_map_remove(struct intern_map *m, struct intern_node *n);
+
+struct intern_node *intern_map_lookup(const struct intern_map *m,
+                                      const char *key);
+
+/* The node returned last may be removed or freed while iterating */
+void intern_map_iterator_init(struct intern_map_iterator *it,
+                              const struct intern_map *m);
+struct intern_node *intern_map_iterator_next(struct intern_map_iterator *it);
+
+#endif /* defined INTERN_H */
@@ -0,0 +1,108 @@
+#include "util/linebuf.h"
+#include "util/log.h"
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#include <string.h>
+
+
+void linebuf_init(struct linebuf *b)
+{
+    b->start = 0;
+    b->scan = 0;
+    b->end = 0;
+}
+
+size_t linebuf_reserve(struct linebuf *b, char **dst)
+{
+    if (b->start > 0) {
+        /* Only the trailing incomplete line, if any, has to be moved */
+        memmove(b->data, b->data + b->start, b->end - b->start);
+
+        b->end -= b->start;
+        b->scan -= b->start;
+        b->start = 0;
+    }
+
+    if (b->end == sizeof(b->data)) {
+        log_warn("Line exceeds %d bytes, discarding", (int)sizeof(b->data));
+
+        linebuf_init(b);
+    }
+
+    *dst = b->data + b->end;
+    return sizeof(b->data) - b->end;
+}
+
+void linebuf_commit(struct linebuf *b, size_t n)
+{
+    b->end += n;
+}
+
+int linebuf_getln(struct linebuf *b, char **line, size_t *len)
+{
+    for (;;) {
+        char *end = b->data + b->end;
+        char *eol = (char *)linebuf_scan_eol(b->data + b->scan, end);
+
+        if (eol == end) {
+            /* No terminator in the rest of the data, don't look again */
+            b->scan = b->end;
+            return 1;
+        }
+
+        *line = b->data + b->start;
+        *len = (size_t)(eol - *line);
+
+        *eol = '\0';
+        b->start = b->scan = (size_t)(eol - b->data) + 1;
+
+        /* Second half of a CRLF or an empty line */
+        if (*len > 0)
+            return 0;
+    }
+}
+
+const char *linebuf_scan_eol(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_cmpeq_epi8(v, cr),
+                    _mm256_cmpeq_epi8(v, lf)));
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    const __m128i lf16 = _mm_set1_epi8('\n');
+
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+                    _mm_cmpeq_epi8(v, cr16),
+                    _mm_cmpeq_epi8(v, lf16)));
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+
+    /* Scalar fallback and tail */
+    for (; p < end; ++p)
+        if ((*p == '\r') || (*p == '\n'))
+            return p;
+
+    return end;
+}
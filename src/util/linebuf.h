@@ -0,0 +1,50 @@
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#include <stdlib.h>
+
+#define LINEBUF_MAX (1024 * 8) /* 8 KiB */
+
+/*
+ * Receive buffer that splits incoming data into lines without copying them.
+ *
+ * Data is received straight into the buffer (linebuf_reserve() and
+ * linebuf_commit()) and handed out as views into it (linebuf_getln()). Lines
+ * are terminated in place, so a view is also a valid C string. Views stay
+ * valid until the next call to linebuf_reserve(), which moves the one
+ * incomplete line left at the end, if any, back to the start of the buffer.
+ *
+ * Every received byte is inspected only once: scan remembers where the search
+ * for the next line terminator stopped.
+ */
+struct linebuf
+{
+    size_t start; /* start of the first line not yet handed out */
+    size_t scan;  /* bytes in [start, scan) contain no line terminator */
+    size_t end;   /* end of received data */
+
+    char data[LINEBUF_MAX];
+};
+
+void linebuf_init(struct linebuf *b);
+
+/*
+ * Make room for new data and return the number of bytes that can be written
+ * to *dst. If a single line fills up the whole buffer it is discarded.
+ */
+size_t linebuf_reserve(struct linebuf *b, char **dst);
+void   linebuf_commit(struct linebuf *b, size_t n);
+
+/*
+ * Fetch the next complete line, without its terminator. Returns 0 on success
+ * or 1 if no complete line is available yet. Lines can be terminated by any
+ * combination of CR and LF, empty lines are skipped.
+ */
+int linebuf_getln(struct linebuf *b, char **line, size_t *len);
+
+/*
+ * Return a pointer to the first CR or LF in [p, end), or end if there is none
+ */
+const char *linebuf_scan_eol(const char *p, const char *end);
+
+#endif /* defined LINEBUF_H */
@@ -1,7 +1,7 @@
 #include "log.h"
+#include "util/clock.h"
 
 #include <stdio.h>
-#include <time.h>
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -115,12 +115,7 @@ int _log_vlogtofilep(
         const char *fmt,
         va_list args)
 {
-    char buffer[TIMEBUF_MAX] = {0};
-    time_t now = time(NULL);
-
-    struct tm *tm = TIME_GETTIME(&now);
-
-    strftime(buffer, sizeof(buffer), STRFTIME_FORMAT, tm);
+    const char *buffer = clock_timestamp();
 
     if (n)
         fprintf(fp, LOG_FORMAT_NAMED "%s",
@@ -0,0 +1,497 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "util/reactor.h"
+#include "util/clock.h"
+#include "util/log.h"
+#include "util/util.h"
+
+#include <sys/select.h>
+
+#ifdef __linux__
+#   include <sys/epoll.h>
+#   include <sys/timerfd.h>
+#   include <sys/eventfd.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+/* Number of events fetched by a single epoll_wait() call */
+#define REACTOR_EPOLL_BATCH 64
+
+
+int reactor_init(struct reactor *r, const struct reactor_backend *backend)
+{
+    memset(r, 0, sizeof(*r));
+
+    if (backend == NULL) {
+#ifdef __linux__
+        backend = &reactor_backend_epoll;
+#else
+        backend = &reactor_backend_select;
+#endif
+    }
+
+    r->backend = backend;
+
+    timerwheel_init(&r->wheel, clock_mono_ms());
+
+    if (r->backend->init(r)) {
+        log_error("Unable to initialize reactor backend '%s': %s",
+                r->backend->name, strerror(errno));
+
+        return 1;
+    }
+
+    log_debug("Using '%s' reactor backend", r->backend->name);
+    return 0;
+}
+
+void reactor_destroy(struct reactor *r)
+{
+    r->backend->destroy(r);
+
+    free(r->watches);
+    memset(r, 0, sizeof(*r));
+}
+
+static struct reactor_watch *_reactor_get_watch(struct reactor *r, int fd)
+{
+    if ((fd < 0) || (fd >= r->nwatches))
+        return NULL;
+
+    if (r->watches[fd].kind == REACTOR_WATCH_NONE)
+        return NULL;
+
+    return &r->watches[fd];
+}
+
+static int _reactor_watch(struct reactor *r,
+                          int fd,
+                          enum reactor_watch_kind kind,
+                          unsigned events,
+                          reactor_handler handler,
+                          void *arg)
+{
+    if (fd < 0)
+        return 1;
+
+    if (fd >= r->nwatches) {
+        int n = MAX(fd + 1, r->nwatches * 2);
+        struct reactor_watch *w = realloc(r->watches, n * sizeof(*w));
+
+        if (!w) {
+            log_error("_reactor_watch(): not enough memory for allocation");
+            return 1;
+        }
+
+        memset(w + r->nwatches, 0, (n - r->nwatches) * sizeof(*w));
+
+        r->watches = w;
+        r->nwatches = n;
+    }
+
+    if (r->watches[fd].kind != REACTOR_WATCH_NONE) {
+        log_warn("Reactor: fd %d is already being watched", fd);
+        return 1;
+    }
+
+    if (r->backend->add(r, fd, events)) {
+        log_error("Reactor: unable to watch fd %d: %s", fd, strerror(errno));
+        return 1;
+    }
+
+    r->watches[fd].kind = kind;
+    r->watches[fd].events = events;
+    r->watches[fd].handler = handler;
+    r->watches[fd].arg = arg;
+
+    return 0;
+}
+
+int reactor_add(struct reactor *r,
+                int fd,
+                unsigned events,
+                reactor_handler handler,
+                void *arg)
+{
+    return _reactor_watch(r, fd, REACTOR_WATCH_IO, events, handler, arg);
+}
+
+int reactor_modify(struct reactor *r, int fd, unsigned events)
+{
+    struct reactor_watch *w = _reactor_get_watch(r, fd);
+
+    if (!w)
+        return 1;
+
+    if (w->events == events)
+        return 0;
+
+    if (r->backend->mod(r, fd, events))
+        return 1;
+
+    w->events = events;
+    return 0;
+}
+
+int reactor_remove(struct reactor *r, int fd)
+{
+    struct reactor_watch *w = _reactor_get_watch(r, fd);
+
+    if (!w)
+        return 1;
+
+    r->backend->del(r, fd);
+    memset(w, 0, sizeof(*w));
+
+    return 0;
+}
+
+int reactor_poll(struct reactor *r, int timeout_ms)
+{
+    uint64_t now = clock_mono_ms();
+    uint64_t next = timerwheel_next(&r->wheel);
+    int n = 0;
+
+    /*
+     * Don't sleep past the next timer on the wheel. Unless time only moves
+     * when it is told to, then only timers that are already due count.
+     */
+    if ((next != UINT64_MAX)
+            && ((next <= now) || !clock_get_source()->manual)) {
+        uint64_t wait = (next > now) ? MIN(next - now, INT_MAX) : 0;
+
+        if ((timeout_ms < 0) || (wait < (uint64_t)timeout_ms))
+            timeout_ms = (int)wait;
+    }
+
+    n = r->backend->wait(r, timeout_ms);
+
+    if ((n < 0) && (errno == EINTR))
+        n = 0;
+
+    if (n >= 0)
+        timerwheel_advance(&r->wheel, clock_mono_ms());
+
+    return n;
+}
+
+void _reactor_dispatch(struct reactor *r, int fd, unsigned events)
+{
+    struct reactor_watch *w = _reactor_get_watch(r, fd);
+
+    if (!w)
+        /* Removed by an earlier handler within the same batch */
+        return;
+
+    if ((w->kind == REACTOR_WATCH_TIMER) || (w->kind == REACTOR_WATCH_NOTIFY)) {
+        uint64_t count;
+
+        /* Reset the fd's readiness, spurious wakeups are silently ignored */
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            return;
+    }
+
+    w->handler(r, fd, events, w->arg);
+}
+
+
+/*
+ * Timers and notifications
+ */
+int reactor_timer_new(struct reactor *r, reactor_handler handler, void *arg)
+{
+#ifdef __linux__
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd < 0) {
+        log_perror("timerfd_create()", LOG_ERROR);
+        return -1;
+    }
+
+    if (_reactor_watch(r, fd, REACTOR_WATCH_TIMER,
+                REACTOR_READ, handler, arg)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    log_error("reactor_timer_new(): not supported on this platform");
+    return -1;
+#endif
+}
+
+int reactor_timer_arm(int fd, unsigned long ms, unsigned long interval_ms)
+{
+#ifdef __linux__
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+    return timerfd_settime(fd, 0, &its, NULL);
+#else
+    return -1;
+#endif
+}
+
+int reactor_notify_new(struct reactor *r, reactor_handler handler, void *arg)
+{
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fd < 0) {
+        log_perror("eventfd()", LOG_ERROR);
+        return -1;
+    }
+
+    if (_reactor_watch(r, fd, REACTOR_WATCH_NOTIFY,
+                REACTOR_READ, handler, arg)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    log_error("reactor_notify_new(): not supported on this platform");
+    return -1;
+#endif
+}
+
+int reactor_notify(int fd)
+{
+    uint64_t one = 1;
+
+    return (write(fd, &one, sizeof(one)) == sizeof(one)) ? 0 : -1;
+}
+
+int reactor_close(struct reactor *r, int fd)
+{
+    if (fd < 0)
+        return 1;
+
+    reactor_remove(r, fd);
+    return close(fd);
+}
+
+void reactor_schedule(struct reactor *r, struct timer *t, unsigned long ms)
+{
+    timerwheel_add(&r->wheel, t, clock_mono_ms() + ms);
+}
+
+void reactor_cancel(struct reactor *r, struct timer *t)
+{
+    timerwheel_del(&r->wheel, t);
+}
+
+
+/*
+ * epoll backend
+ */
+#ifdef __linux__
+struct _reactor_epoll
+{
+    int epfd;
+    struct epoll_event events[REACTOR_EPOLL_BATCH];
+};
+
+static uint32_t _reactor_epoll_events(unsigned events)
+{
+    return ((events & REACTOR_READ)  ? EPOLLIN  : 0)
+         | ((events & REACTOR_WRITE) ? EPOLLOUT : 0);
+}
+
+static int _reactor_epoll_init(struct reactor *r)
+{
+    struct _reactor_epoll *ep = malloc(sizeof(*ep));
+
+    if (!ep)
+        return 1;
+
+    if ((ep->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(ep);
+        return 1;
+    }
+
+    r->data = ep;
+    return 0;
+}
+
+static void _reactor_epoll_destroy(struct reactor *r)
+{
+    struct _reactor_epoll *ep = r->data;
+
+    close(ep->epfd);
+    free(ep);
+}
+
+static int _reactor_epoll_ctl(struct reactor *r, int op, int fd, unsigned ev)
+{
+    struct _reactor_epoll *ep = r->data;
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = _reactor_epoll_events(ev);
+    event.data.fd = fd;
+
+    return epoll_ctl(ep->epfd, op, fd, &event) < 0;
+}
+
+static int _reactor_epoll_add(struct reactor *r, int fd, unsigned events)
+{
+    return _reactor_epoll_ctl(r, EPOLL_CTL_ADD, fd, events);
+}
+
+static int _reactor_epoll_mod(struct reactor *r, int fd, unsigned events)
+{
+    return _reactor_epoll_ctl(r, EPOLL_CTL_MOD, fd, events);
+}
+
+static int _reactor_epoll_del(struct reactor *r, int fd)
+{
+    return _reactor_epoll_ctl(r, EPOLL_CTL_DEL, fd, 0);
+}
+
+static int _reactor_epoll_wait(struct reactor *r, int timeout_ms)
+{
+    struct _reactor_epoll *ep = r->data;
+    int n = epoll_wait(ep->epfd, ep->events, REACTOR_EPOLL_BATCH, timeout_ms);
+
+    clock_update();
+
+    for (int i = 0; i < n; ++i) {
+        uint32_t ev = ep->events[i].events;
+
+        _reactor_dispatch(r, ep->events[i].data.fd,
+                ((ev & EPOLLIN)  ? REACTOR_READ  : 0) |
+                ((ev & EPOLLOUT) ? REACTOR_WRITE : 0) |
+                ((ev & (EPOLLERR | EPOLLHUP)) ? REACTOR_ERROR : 0));
+    }
+
+    return n;
+}
+
+const struct reactor_backend reactor_backend_epoll = {
+    .name = "epoll",
+
+    .init = _reactor_epoll_init,
+    .destroy = _reactor_epoll_destroy,
+
+    .add = _reactor_epoll_add,
+    .mod = _reactor_epoll_mod,
+    .del = _reactor_epoll_del,
+
+    .wait = _reactor_epoll_wait
+};
+#endif /* defined __linux__ */
+
+
+/*
+ * select backend, rebuilds its fd sets from the watch table on every call.
+ */
+static int _reactor_select_init(struct reactor *r)
+{
+    (void)r;
+    return 0;
+}
+
+static void _reactor_select_destroy(struct reactor *r)
+{
+    (void)r;
+}
+
+static int _reactor_select_add(struct reactor *r, int fd, unsigned events)
+{
+    (void)r;
+    (void)events;
+
+    return fd >= FD_SETSIZE;
+}
+
+static int _reactor_select_mod(struct reactor *r, int fd, unsigned events)
+{
+    (void)r;
+    (void)fd;
+    (void)events;
+
+    return 0;
+}
+
+static int _reactor_select_del(struct reactor *r, int fd)
+{
+    (void)r;
+    (void)fd;
+
+    return 0;
+}
+
+static int _reactor_select_wait(struct reactor *r, int timeout_ms)
+{
+    fd_set reads;
+    fd_set writes;
+
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000
+    };
+
+    int maxfd = -1;
+    int n;
+
+    FD_ZERO(&reads);
+    FD_ZERO(&writes);
+
+    for (int fd = 0; fd < r->nwatches; ++fd) {
+        if (r->watches[fd].kind == REACTOR_WATCH_NONE)
+            continue;
+
+        if (r->watches[fd].events & REACTOR_READ)
+            FD_SET(fd, &reads);
+
+        if (r->watches[fd].events & REACTOR_WRITE)
+            FD_SET(fd, &writes);
+
+        maxfd = fd;
+    }
+
+    n = select(maxfd + 1, &reads, &writes, NULL, (timeout_ms < 0) ? NULL : &tv);
+
+    clock_update();
+
+    if (n <= 0)
+        return n;
+
+    for (int fd = 0; fd <= maxfd; ++fd) {
+        unsigned ev = (FD_ISSET(fd, &reads)  ? REACTOR_READ  : 0)
+                    | (FD_ISSET(fd, &writes) ? REACTOR_WRITE : 0);
+
+        if (ev)
+            _reactor_dispatch(r, fd, ev);
+    }
+
+    return n;
+}
+
+const struct reactor_backend reactor_backend_select = {
+    .name = "select",
+
+    .init = _reactor_select_init,
+    .destroy = _reactor_select_destroy,
+
+    .add = _reactor_select_add,
+    .mod = _reactor_select_mod,
+    .del = _reactor_select_del,
+
+    .wait = _reactor_select_wait
+};
@@ -0,0 +1,134 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "util/timerwheel.h"
+
+#include <stdint.h>
+
+/*
+ * A small reactor that owns every file descriptor the bot is interested in
+ * (sockets, timers and notification fds) and dispatches readiness events to
+ * per-fd handlers.
+ *
+ * The actual polling is delegated to a backend, so that platforms without
+ * epoll can plug in their own mechanism. The default backend is epoll on Linux
+ * and select() everywhere else.
+ *
+ * Besides timer fds, the reactor drives a timer wheel with millisecond ticks
+ * for large numbers of cheap timers, which only bound the time spent waiting
+ * for events and need no fd at all.
+ */
+
+/* Event flags, can be or'ed together */
+#define REACTOR_READ  (1u << 0)
+#define REACTOR_WRITE (1u << 1)
+#define REACTOR_ERROR (1u << 2)
+
+struct reactor;
+
+typedef void (*reactor_handler)(struct reactor *r,
+                                int fd,
+                                unsigned events,
+                                void *arg);
+
+struct reactor_backend
+{
+    const char *name;
+
+    int  (*init)(struct reactor *r);
+    void (*destroy)(struct reactor *r);
+
+    int (*add)(struct reactor *r, int fd, unsigned events);
+    int (*mod)(struct reactor *r, int fd, unsigned events);
+    int (*del)(struct reactor *r, int fd);
+
+    /*
+     * Wait up to timeout_ms milliseconds (-1 = forever), call clock_update()
+     * once the wait is over and then _reactor_dispatch() for each ready fd.
+     * Returns the number of dispatched fds or < 0 on error.
+     */
+    int (*wait)(struct reactor *r, int timeout_ms);
+};
+
+enum reactor_watch_kind
+{
+    REACTOR_WATCH_NONE,
+    REACTOR_WATCH_IO,
+    REACTOR_WATCH_TIMER,  /* timerfd, expirations are read before dispatch */
+    REACTOR_WATCH_NOTIFY  /* eventfd, counter is read before dispatch */
+};
+
+struct reactor_watch
+{
+    enum reactor_watch_kind kind;
+    unsigned events;
+
+    reactor_handler handler;
+    void *arg;
+};
+
+struct reactor
+{
+    const struct reactor_backend *backend;
+    void *data; /* backend private state */
+
+    /* Watches, indexed by file descriptor */
+    struct reactor_watch *watches;
+    int nwatches;
+
+    struct timerwheel wheel;
+};
+
+#ifdef __linux__
+extern const struct reactor_backend reactor_backend_epoll;
+#endif
+extern const struct reactor_backend reactor_backend_select;
+
+/*
+ * If backend is NULL, the best available backend is used.
+ */
+int  reactor_init(struct reactor *r, const struct reactor_backend *backend);
+void reactor_destroy(struct reactor *r);
+
+int reactor_add(struct reactor *r,
+                int fd,
+                unsigned events,
+                reactor_handler handler,
+                void *arg);
+
+int reactor_modify(struct reactor *r, int fd, unsigned events);
+int reactor_remove(struct reactor *r, int fd);
+
+/*
+ * Wait for events and dispatch them, see reactor_backend.wait
+ */
+int reactor_poll(struct reactor *r, int timeout_ms);
+
+/*
+ * Timers and notifications. Both are plain fds owned by the reactor, and have
+ * to be released with reactor_close().
+ *
+ * A timer fires once after `ms' milliseconds and then every `interval_ms'
+ * milliseconds, unless interval_ms is 0. Arming a timer with ms = 0 disarms it.
+ */
+int reactor_timer_new(struct reactor *r, reactor_handler handler, void *arg);
+int reactor_timer_arm(int fd, unsigned long ms, unsigned long interval_ms);
+
+int reactor_notify_new(struct reactor *r, reactor_handler handler, void *arg);
+int reactor_notify(int fd);
+
+int reactor_close(struct reactor *r, int fd);
+
+/*
+ * Timers on the timer wheel. reactor_schedule() (re)arms t, set up with
+ * timer_init(), to fire once `ms' milliseconds after the current loop
+ * iteration started (see util/clock.h). Its callback runs from within
+ * reactor_poll().
+ */
+void reactor_schedule(struct reactor *r, struct timer *t, unsigned long ms);
+void reactor_cancel(struct reactor *r, struct timer *t);
+
+/* Internal, used by backends */
+void _reactor_dispatch(struct reactor *r, int fd, unsigned events);
+
+#endif /* defined REACTOR_H */
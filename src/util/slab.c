@@ -0,0 +1,118 @@
+#include "util/slab.h"
+#include "util/log.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/* Strictest alignment any of the cached structures can need */
+union _slab_align
+{
+    long double ld;
+    uint64_t u;
+    void *p;
+    void (*fn)(void);
+};
+
+#define SLAB_ALIGN sizeof(union _slab_align)
+#define SLAB_ROUND(n) (((n) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN)
+
+struct slab
+{
+    struct slab *next;
+};
+
+#define SLAB_HEADER SLAB_ROUND(sizeof(struct slab))
+
+
+void slab_cache_init(struct slab_cache *c, const char *name, size_t size)
+{
+    memset(c, 0, sizeof(*c));
+
+    c->name = name;
+
+    /* Free objects hold the free list link */
+    c->size = SLAB_ROUND(size < sizeof(void *) ? sizeof(void *) : size);
+    c->per_slab = (SLAB_SIZE - SLAB_HEADER) / c->size;
+
+    if (c->per_slab == 0)
+        c->per_slab = 1;
+}
+
+void slab_cache_destroy(struct slab_cache *c)
+{
+    struct slab *s = c->slabs;
+
+    if (c->in_use)
+        log_debug("slab cache '%s' destroyed with %lu objects in use",
+                c->name, c->in_use);
+
+    while (s) {
+        struct slab *next = s->next;
+
+        free(s);
+        s = next;
+    }
+
+    c->slabs = NULL;
+    c->free = NULL;
+    c->nslabs = 0;
+    c->in_use = 0;
+}
+
+static int _slab_grow(struct slab_cache *c)
+{
+    struct slab *s = malloc(SLAB_HEADER + c->per_slab * c->size);
+    char *obj = NULL;
+
+    if (!s) {
+        log_error("slab cache '%s': not enough memory for a new slab", c->name);
+        return 1;
+    }
+
+    s->next = c->slabs;
+    c->slabs = s;
+    c->nslabs++;
+
+    /* Thread the new objects onto the free list, first one first */
+    obj = (char *)s + SLAB_HEADER + (c->per_slab - 1) * c->size;
+
+    for (size_t i = 0; i < c->per_slab; ++i, obj -= c->size) {
+        *(void **)obj = c->free;
+        c->free = obj;
+    }
+
+    return 0;
+}
+
+void *slab_alloc(struct slab_cache *c)
+{
+    void *obj = NULL;
+
+    if (!c->free && _slab_grow(c))
+        return NULL;
+
+    obj = c->free;
+    c->free = *(void **)obj;
+
+    if (++c->in_use > c->peak)
+        c->peak = c->in_use;
+
+    return memset(obj, 0, c->size);
+}
+
+void slab_free(struct slab_cache *c, void *obj)
+{
+    if (!obj)
+        return;
+
+    *(void **)obj = c->free;
+    c->free = obj;
+
+    c->in_use--;
+}
+
+size_t slab_cache_bytes(const struct slab_cache *c)
+{
+    return c->nslabs * (SLAB_HEADER + c->per_slab * c->size);
+}
@@ -0,0 +1,47 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdlib.h>
+
+/*
+ * Object caches for fixed size structures that come and go in large numbers,
+ * such as channel members during a WHO burst or a netsplit.
+ *
+ * Objects are carved out of slabs of SLAB_SIZE bytes, and freed objects are
+ * kept on a free list for the next allocation instead of being handed back to
+ * malloc. Slabs are only released along with the whole cache, so a cache
+ * settles at the size of its peak use.
+ */
+#define SLAB_SIZE (64 * 1024) /* 64 KiB */
+
+struct slab;
+
+struct slab_cache
+{
+    const char *name;
+
+    size_t size;     /* object size, rounded up for alignment */
+    size_t per_slab; /* objects per slab */
+
+    struct slab *slabs;
+    void *free;      /* free objects, linked through their first bytes */
+
+    /* Statistics */
+    unsigned long nslabs;
+    unsigned long in_use;
+    unsigned long peak;
+};
+
+void slab_cache_init(struct slab_cache *c, const char *name, size_t size);
+
+/* Releases every slab, objects still in use included */
+void slab_cache_destroy(struct slab_cache *c);
+
+/* Returns zeroed memory for one object or NULL */
+void *slab_alloc(struct slab_cache *c);
+void  slab_free(struct slab_cache *c, void *obj);
+
+/* Bytes held by the cache, in use or not */
+size_t slab_cache_bytes(const struct slab_cache *c);
+
+#endif /* defined SLAB_H */
@@ -0,0 +1,188 @@
+#include "util/timerwheel.h"
+#include "util/util.h"
+
+#include <string.h>
+
+/* Number of ticks covered by one slot of a level, and by the whole level */
+#define _TIMERWHEEL_SLOT_SPAN(level)  (UINT64_C(1) << (TIMERWHEEL_BITS * (level)))
+#define _TIMERWHEEL_LEVEL_SPAN(level) _TIMERWHEEL_SLOT_SPAN((level) + 1)
+
+/* Farthest a timer can be placed into the future */
+#define _TIMERWHEEL_RANGE (_TIMERWHEEL_LEVEL_SPAN(TIMERWHEEL_LEVELS - 1) - 1)
+
+
+void timer_init(struct timer *t, timer_func fn, void *arg)
+{
+    memset(t, 0, sizeof(*t));
+
+    t->fn = fn;
+    t->arg = arg;
+}
+
+int timer_pending(const struct timer *t)
+{
+    return t->pprev != NULL;
+}
+
+void timerwheel_init(struct timerwheel *w, uint64_t now)
+{
+    memset(w, 0, sizeof(*w));
+
+    w->now = now;
+}
+
+static void _timerwheel_link(struct timer **head, struct timer *t)
+{
+    if ((t->next = *head))
+        t->next->pprev = &t->next;
+
+    t->pprev = head;
+    *head = t;
+}
+
+static void _timerwheel_unlink(struct timer *t)
+{
+    if (t->next)
+        t->next->pprev = t->pprev;
+
+    *t->pprev = t->next;
+
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+static void _timerwheel_place(struct timerwheel *w, struct timer *t)
+{
+    uint64_t expires = MAX(t->expires, w->now);
+    uint64_t delta = expires - w->now;
+    int level = 0;
+
+    if (delta > _TIMERWHEEL_RANGE) {
+        /* Out of range, revisited once its slot is cascaded */
+        delta = _TIMERWHEEL_RANGE;
+        expires = w->now + delta;
+    }
+
+    while (delta >= _TIMERWHEEL_LEVEL_SPAN(level))
+        level++;
+
+    _timerwheel_link(&w->slots[level][
+            (expires >> (TIMERWHEEL_BITS * level)) & TIMERWHEEL_MASK], t);
+}
+
+void timerwheel_add(struct timerwheel *w, struct timer *t, uint64_t expires)
+{
+    if (timer_pending(t))
+        _timerwheel_unlink(t);
+    else
+        w->count++;
+
+    t->expires = expires;
+    _timerwheel_place(w, t);
+}
+
+void timerwheel_del(struct timerwheel *w, struct timer *t)
+{
+    if (!timer_pending(t))
+        return;
+
+    _timerwheel_unlink(t);
+    w->count--;
+}
+
+/*
+ * Move the timers of a slot one or more levels down, now that the level
+ * below has caught up with it
+ */
+static void _timerwheel_cascade(struct timerwheel *w, int level, int slot)
+{
+    struct timer *t = w->slots[level][slot];
+
+    w->slots[level][slot] = NULL;
+
+    while (t) {
+        struct timer *next = t->next;
+
+        _timerwheel_place(w, t);
+        t = next;
+    }
+}
+
+/*
+ * Process tick w->now
+ */
+static void _timerwheel_tick(struct timerwheel *w)
+{
+    struct timer *expired = NULL;
+    int level;
+
+    for (level = 1; level < TIMERWHEEL_LEVELS; ++level) {
+        if (w->now & (_TIMERWHEEL_SLOT_SPAN(level) - 1))
+            break;
+
+        _timerwheel_cascade(w, level,
+                (w->now >> (TIMERWHEEL_BITS * level)) & TIMERWHEEL_MASK);
+    }
+
+    /*
+     * Take the slot's timers off the wheel before running any of them, timers
+     * (re)added by a callback for "now" fire on the next tick instead of
+     * being picked up by this one.
+     */
+    if ((expired = w->slots[0][w->now & TIMERWHEEL_MASK])) {
+        expired->pprev = &expired;
+        w->slots[0][w->now & TIMERWHEEL_MASK] = NULL;
+    }
+
+    w->now++;
+
+    while (expired) {
+        struct timer *t = expired;
+
+        _timerwheel_unlink(t);
+        w->count--;
+
+        t->fn(t, t->arg);
+    }
+}
+
+void timerwheel_advance(struct timerwheel *w, uint64_t now)
+{
+    while (w->now <= now) {
+        uint64_t next = timerwheel_next(w);
+
+        if (next > now) {
+            /* Nothing to do in between, skip ahead */
+            w->now = now + 1;
+            break;
+        }
+
+        w->now = next;
+        _timerwheel_tick(w);
+    }
+}
+
+uint64_t timerwheel_next(const struct timerwheel *w)
+{
+    uint64_t next = UINT64_MAX;
+    int level;
+
+    if (w->count == 0)
+        return UINT64_MAX;
+
+    for (level = 0; level < TIMERWHEEL_LEVELS; ++level) {
+        /* First tick on or after now at which a slot of this level is up */
+        uint64_t span = _TIMERWHEEL_SLOT_SPAN(level);
+        uint64_t base = (w->now + span - 1) >> (TIMERWHEEL_BITS * level);
+        uint64_t k;
+
+        for (k = 0; k < TIMERWHEEL_SLOTS; ++k) {
+            if (w->slots[level][(base + k) & TIMERWHEEL_MASK]) {
+                next = MIN(next, (base + k) << (TIMERWHEEL_BITS * level));
+                break;
+            }
+        }
+    }
+
+    return next;
+}
@@ -0,0 +1,79 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Time is counted in ticks (the reactor uses milliseconds). The first level
+ * has one slot per tick for the next TIMERWHEEL_SLOTS ticks, every further
+ * level covers TIMERWHEEL_SLOTS times the range of the one below at the same
+ * granularity ratio. Timers are hooked into the slot their expiry falls into
+ * and are moved down a level ("cascaded") when the lower level wraps around
+ * to their slot, so adding, moving and cancelling a timer is O(1) regardless
+ * of how many are pending.
+ *
+ * Timers further out than the wheel's range are parked in the last slot of
+ * the highest level and placed again whenever they are cascaded.
+ */
+#define TIMERWHEEL_BITS   8
+#define TIMERWHEEL_SLOTS  (1 << TIMERWHEEL_BITS)
+#define TIMERWHEEL_MASK   (TIMERWHEEL_SLOTS - 1)
+#define TIMERWHEEL_LEVELS 4
+
+struct timer;
+
+typedef void (*timer_func)(struct timer *t, void *arg);
+
+/*
+ * Embedded by the owner of the timer, the wheel never allocates.
+ */
+struct timer
+{
+    struct timer *next;
+    struct timer **pprev; /* NULL if not pending */
+
+    uint64_t expires;
+
+    timer_func fn;
+    void *arg;
+};
+
+struct timerwheel
+{
+    /* Next tick to be processed */
+    uint64_t now;
+
+    /* Number of pending timers */
+    unsigned long count;
+
+    struct timer *slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+};
+
+void timer_init(struct timer *t, timer_func fn, void *arg);
+int  timer_pending(const struct timer *t);
+
+void timerwheel_init(struct timerwheel *w, uint64_t now);
+
+/*
+ * Schedule t to fire once at tick `expires'. A timer that is already pending
+ * is moved. Expiries in the past fire with the next call to
+ * timerwheel_advance().
+ */
+void timerwheel_add(struct timerwheel *w, struct timer *t, uint64_t expires);
+void timerwheel_del(struct timerwheel *w, struct timer *t);
+
+/*
+ * Run every timer expiring up to and including tick `now'. Callbacks are free
+ * to add, move or cancel any timer, including their own.
+ */
+void timerwheel_advance(struct timerwheel *w, uint64_t now);
+
+/*
+ * Earliest tick at which timerwheel_advance() has any work to do, either
+ * firing or cascading timers. UINT64_MAX if no timer is pending.
+ */
+uint64_t timerwheel_next(const struct timerwheel *w);
+
+#endif /* defined TIMERWHEEL_H */
@@ -1,13 +1,14 @@
 #include "tokenbucket.h"
 
+#include "util/clock.h"
 #include "util/util.h"
 
 
 void tokenbucket_init(struct tokenbucket *b, unsigned capacity, unsigned rate)
 {
-    b->last_update = time(NULL);
+    b->last_update = clock_mono_ns();
 
-    b->tokens = capacity;
+    b->tokens = capacity * TOKENBUCKET_SCALE;
 
     b->capacity = capacity;
     b->fill_rate = rate;
@@ -15,23 +16,44 @@ void tokenbucket_init(struct tokenbucket *b, unsigned capacity, unsigned rate)
 
 void tokenbucket_generate(struct tokenbucket *b)
 {
-    time_t now = time(NULL);
-
-    if (b->tokens < b->capacity) {
-        unsigned newtoks = b->fill_rate * (now - b->last_update);
-
-        b->tokens = MIN(b->capacity, b->tokens + newtoks);
-    }
+    uint64_t now = clock_mono_ns();
+    uint64_t full = b->capacity * TOKENBUCKET_SCALE;
+    uint64_t elapsed = now - b->last_update;
+
+    /*
+     * A scaled token per nanosecond and token of fill rate. Check against the
+     * time needed to fill up first, so long idle times can not overflow.
+     */
+    if ((b->fill_rate == 0) || (elapsed >= (full - b->tokens) / b->fill_rate))
+        b->tokens = (b->fill_rate == 0) ? b->tokens : full;
+    else
+        b->tokens += elapsed * b->fill_rate;
 
     b->last_update = now;
 }
 
 bool tokenbucket_consume(struct tokenbucket *b, unsigned tokens)
 {
-    if (tokens <= b->tokens) {
-        b->tokens -= tokens;
+    uint64_t scaled = tokens * TOKENBUCKET_SCALE;
+
+    if (scaled <= b->tokens) {
+        b->tokens -= scaled;
         return true;
     }
 
     return false;
 }
+
+uint64_t tokenbucket_wait_ns(const struct tokenbucket *b, unsigned tokens)
+{
+    uint64_t scaled = tokens * TOKENBUCKET_SCALE;
+
+    if (scaled <= b->tokens)
+        return 0;
+
+    if ((b->fill_rate == 0) || (tokens > b->capacity))
+        return UINT64_MAX; /* never */
+
+    /* Round up, to not wake up a nanosecond too early */
+    return (scaled - b->tokens + b->fill_rate - 1) / b->fill_rate;
+}
@@ -3,13 +3,22 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
-#include <time.h>
+#include <stdint.h>
+
+/*
+ * Token bucket driven by the monotonic clock.
+ *
+ * Tokens are accounted for in units of 1/TOKENBUCKET_SCALE tokens, so refill
+ * happens continuously instead of in lumps of fill_rate tokens once a second,
+ * and no fractional refill is lost between updates.
+ */
+#define TOKENBUCKET_SCALE UINT64_C(1000000000) /* one token per nanosecond */
 
 struct tokenbucket
 {
-    time_t last_update;
+    uint64_t last_update; /* nanoseconds, CLOCK_MONOTONIC */
 
-    unsigned tokens;
+    uint64_t tokens;      /* scaled by TOKENBUCKET_SCALE */
 
     unsigned capacity;  /* maximum number of tokens */
     unsigned fill_rate; /* fill rate per second */
@@ -19,5 +28,12 @@ void tokenbucket_init(struct tokenbucket *b, unsigned capacity, unsigned rate);
 void tokenbucket_generate(struct tokenbucket *b);
 bool tokenbucket_consume(struct tokenbucket *b, unsigned tokens);
 
+/*
+ * Nanoseconds from the last update until `tokens' tokens will be available,
+ * 0 if they already are. Call tokenbucket_generate() first for an answer
+ * relative to now.
+ */
+uint64_t tokenbucket_wait_ns(const struct tokenbucket *b, unsigned tokens);
+
 
 #endif /* define TOKENBUCKET_H */